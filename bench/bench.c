@@ -0,0 +1,695 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+
+/*
+ * Microbenchmarks for the request path: parsing, URL decoding, MIME
+ * lookups, UTF-8 conversion and the string scanners. They run on the real
+ * sources, built on Linux (or any POSIX system) with the Win32 shim in
+ * bench/posix, from the top of the tree:
+ *
+ *   cc -O2 -fshort-wchar -Ibench/posix -I. -o bench/bench bench/bench.c \
+ *      bench/posix/win32.c http.c mime.c unicode.c util.c -lm
+ *   bench/bench [-r repetitions] [-t milliseconds] [-m mime.txt] [name filter]
+ *
+ * Each benchmark is run until one sample takes the target time, which
+ * doubles as the warmup, then timed for the given number of samples. The
+ * median is reported with the fastest sample and the spread.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+#include "tinyhttp.h"
+#include "http.h"
+#include "mime.h"
+#include "simd.h"
+#include "unicode.h"
+#include "util.h"
+
+#define MAX_SAMPLES 101
+
+typedef struct {
+	const char *name;
+	void (*run)(long iterations);
+	/* bytes processed by one iteration, NULL if throughput means nothing */
+	const double *bytes;
+} benchmark;
+
+/* results go here so the compiler cannot drop the work */
+static volatile DWORD sink;
+
+static double Now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/* corpora */
+
+static const char *requests[] = {
+	/* Chrome */
+	"GET /assets/app.3f9c2e.js HTTP/1.1\r\n"
+	"Host: 192.168.1.20:8080\r\n"
+	"Connection: keep-alive\r\n"
+	"sec-ch-ua: \"Chromium\";v=\"124\", \"Google Chrome\";v=\"124\", \"Not-A.Brand\";v=\"99\"\r\n"
+	"sec-ch-ua-mobile: ?0\r\n"
+	"User-Agent: Mozilla/5.0 (Windows NT 10.0; Win64; x64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/124.0.0.0 Safari/537.36\r\n"
+	"sec-ch-ua-platform: \"Windows\"\r\n"
+	"Accept: */*\r\n"
+	"Sec-Fetch-Site: same-origin\r\n"
+	"Sec-Fetch-Mode: no-cors\r\n"
+	"Sec-Fetch-Dest: script\r\n"
+	"Referer: http://192.168.1.20:8080/\r\n"
+	"Accept-Encoding: gzip, deflate, br, zstd\r\n"
+	"Accept-Language: en-US,en;q=0.9,de;q=0.8\r\n"
+	"Cookie: session=9b1e6c0a7f3d4e2b8c5a1f0e9d7c6b5a; theme=dark; _ga=GA1.1.1234567890.1700000000; _ga_X1Y2Z3=GS1.1.1700000000.3.1.1700000300.0.0.0\r\n"
+	"If-None-Match: \"1d9a3c2b4e5f600-1a2b3\"\r\n"
+	"If-Modified-Since: Tue, 14 May 2024 08:12:45 GMT\r\n"
+	"\r\n",
+	/* Firefox */
+	"GET /downloads/%D0%9E%D1%82%D1%87%D1%91%D1%82%202024.pdf HTTP/1.1\r\n"
+	"Host: fileserver.local:8080\r\n"
+	"User-Agent: Mozilla/5.0 (X11; Linux x86_64; rv:125.0) Gecko/20100101 Firefox/125.0\r\n"
+	"Accept: text/html,application/xhtml+xml,application/xml;q=0.9,image/avif,image/webp,*/*;q=0.8\r\n"
+	"Accept-Language: ru-RU,ru;q=0.8,en-US;q=0.5,en;q=0.3\r\n"
+	"Accept-Encoding: gzip, deflate\r\n"
+	"Connection: keep-alive\r\n"
+	"Upgrade-Insecure-Requests: 1\r\n"
+	"Range: bytes=1048576-\r\n"
+	"If-Range: \"1d9a3c2b4e5f600-4c4b40\"\r\n"
+	"Priority: u=0, i\r\n"
+	"\r\n",
+	/* curl */
+	"GET /iso/install.iso HTTP/1.1\r\n"
+	"Host: 10.0.0.5:8080\r\n"
+	"User-Agent: curl/8.7.1\r\n"
+	"Accept: */*\r\n"
+	"\r\n"
+};
+
+#define REQUEST_COUNT (sizeof(requests) / sizeof(requests[0]))
+
+static const char *encodedPaths[] = {
+	"/%E6%96%87%E6%A1%A3/%E9%A1%B9%E7%9B%AE%E8%AE%A1%E5%88%92/%E7%AC%AC%E4%B8%80%E5%AD%A3%E5%BA%A6%E6%8A%A5%E5%91%8A.docx",
+	"/%D0%94%D0%BE%D0%BA%D1%83%D0%BC%D0%B5%D0%BD%D1%82%D1%8B/%D0%9E%D1%82%D1%87%D1%91%D1%82%202024.pdf",
+	"/photos/2024/Summer+Trip/%F0%9F%8C%8A%20beach%20day%20%F0%9F%98%8E/IMG_20240712_154233.jpg",
+	"/music/Bj%C3%B6rk/Vespertine/01%20-%20Hidden%20Place.flac",
+	"/src/tinyhttp/releases/download/v1.4.2/tinyhttp-1.4.2-win64.zip",
+	"/caf%c3%a9/men%c3%bc%20du%20jour.html"
+};
+
+#define PATH_COUNT (sizeof(encodedPaths) / sizeof(encodedPaths[0]))
+
+static const char *fileNames[] = {
+	"www\\index.html", "www\\assets\\style.css", "www\\assets\\app.3f9c2e.js", "www\\photos\\IMG_4411.JPG",
+	"www\\backups\\site.tar.gz", "www\\README", "www\\api\\data.json", "www\\video\\talk.mp4",
+	"www\\fonts\\inter.woff2", "www\\notes.v2.final.txt", "www\\bin\\setup.exe", "www\\docs\\manual.pdf"
+};
+
+#define NAME_COUNT (sizeof(fileNames) / sizeof(fileNames[0]))
+
+static const char *headerNames[] = {
+	"Host", "Connection", "User-Agent", "Accept", "Accept-Encoding", "Accept-Language",
+	"Cookie", "Referer", "If-None-Match", "If-Modified-Since", "Range", "If-Range"
+};
+
+#define HEADER_NAME_COUNT (sizeof(headerNames) / sizeof(headerNames[0]))
+
+/* directory entries by script, for the transcoders at the length they really see */
+#define CORPUS_ASCII 0
+#define CORPUS_LATIN 1
+#define CORPUS_CJK 2
+#define CORPUS_EMOJI 3
+#define CORPUS_COUNT 4
+#define CORPUS_NAMES 8
+
+static const char *nameCorpora[CORPUS_COUNT][CORPUS_NAMES] = {
+	{ "quarterly-report-2024.pdf", "IMG_20240712_154233.jpg", "setup-x64.exe", "meeting notes.txt",
+	  "tinyhttp-1.4.2-win64.zip", "style.min.css", "Hidden Place.flac", "backup_2024-05-14.tar.gz" },
+	{ "Überblick Präsentation.pptx", "naïve café menu.html", "Björk - Hidden Place.flac", "Отчёт 2024.pdf",
+	  "Документы проекта.docx", "Ελληνικά σημειώσεις.txt", "façade élévation.dwg", "Ærøskøbing sommer.jpg" },
+	{ "第一季度报告.docx", "项目计划书.pdf", "会議の議事録.txt", "写真アルバム 2024.zip",
+	  "한국어 문서.hwp", "设计稿最终版.psd", "東京旅行 写真.jpg", "数据分析结果.xlsx" },
+	{ "🎉 party 🎂.jpg", "🌊 beach day 😎.mp4", "🚀 launch plan.pdf", "📁 archive 🗄️.zip",
+	  "❤️ favourites.m3u", "🐱🐶 pets.png", "🍕 recipes 🍝.docx", "👨‍👩‍👧 family 2024.jpg" }
+};
+
+static double requestBytes, pathBytes, nameBytes, headerNameBytes, smallMimeBytes, largeMimeBytes;
+static double hexBytes = 22, textBytes = 4095;
+static char asciiText[4096], mixedText[4096];
+static wchar_t asciiWide[4096], mixedWide[4096];
+static wchar_t wideCorpora[CORPUS_COUNT][CORPUS_NAMES][128];
+static double corpusBytes[CORPUS_COUNT];
+static char largeMimePath[64];
+static const char *smallMimePath = "mime.txt";
+static httpRequest parsedRequest;
+
+/* benchmarks */
+
+static void BenchParseRequest(long iterations)
+{
+	httpRequest request;
+	long n;
+	size_t i;
+
+	for (n = 0; n < iterations; n++)
+		for (i = 0; i < REQUEST_COUNT; i++)
+		{
+			int length = (int)strlen(requests[i]);
+
+			HttpInitRequest(&request);
+			sink += (DWORD)HttpParseRequest(&request, requests[i], length, BUFFER_SIZE - 1);
+			sink += (DWORD)request.headerCount;
+		}
+}
+
+/* the head arriving in pieces of about one TCP segment of a slow client */
+static void BenchParseRequestSplit(long iterations)
+{
+	httpRequest request;
+	long n;
+	size_t i;
+
+	for (n = 0; n < iterations; n++)
+		for (i = 0; i < REQUEST_COUNT; i++)
+		{
+			int length = (int)strlen(requests[i]), received;
+
+			HttpInitRequest(&request);
+			for (received = 0; received < length; )
+			{
+				received += 96;
+				if (received > length)
+					received = length;
+				sink += (DWORD)HttpParseRequest(&request, requests[i], received, BUFFER_SIZE - 1);
+			}
+		}
+}
+
+static void BenchFindHeader(long iterations)
+{
+	long n;
+	size_t i;
+
+	for (n = 0; n < iterations; n++)
+		for (i = 0; i < HEADER_NAME_COUNT; i++)
+			sink += HttpFindHeader(&parsedRequest, headerNames[i]) != NULL;
+}
+
+static void BenchUrlDecode(long iterations)
+{
+	char decoded[MAX_PATH_LEN];
+	long n;
+	size_t i;
+
+	for (n = 0; n < iterations; n++)
+		for (i = 0; i < PATH_COUNT; i++)
+		{
+			UrlDecode(decoded, encodedPaths[i] + 1);
+			sink += (BYTE)decoded[0];
+		}
+}
+
+static void BenchHexToInt(long iterations)
+{
+	static const char digits[] = "0123456789abcdefABCDEF";
+	long n;
+	int i;
+
+	for (n = 0; n < iterations; n++)
+		for (i = 0; i < (int)sizeof(digits) - 1; i++)
+			sink += (DWORD)HexToInt(digits[i]);
+}
+
+static void BenchGetMimeType(long iterations)
+{
+	long n;
+	size_t i;
+
+	for (n = 0; n < iterations; n++)
+		for (i = 0; i < NAME_COUNT; i++)
+			sink += (BYTE)GetMimeType(fileNames[i])[0];
+}
+
+static void BenchLoadMimeTypes(const char *path, long iterations)
+{
+	long n;
+
+	for (n = 0; n < iterations; n++)
+	{
+		FreeMimeTypes();
+		sink += (DWORD)LoadMimeTypes(path);
+	}
+}
+
+static void BenchLoadSmallMime(long iterations)
+{
+	BenchLoadMimeTypes(smallMimePath, iterations);
+}
+
+static void BenchLoadLargeMime(long iterations)
+{
+	BenchLoadMimeTypes(largeMimePath, iterations);
+}
+
+/* the same lookups against a table with thousands of entries */
+static void BenchGetMimeTypeLarge(long iterations)
+{
+	BenchGetMimeType(iterations);
+}
+
+static void BenchUtf8ToWide(const char *text, long iterations)
+{
+	static wchar_t wide[4096];
+	long n;
+
+	for (n = 0; n < iterations; n++)
+		sink += (DWORD)Utf8ToWide(text, wide, 4096);
+}
+
+static void BenchWideToUtf8(const wchar_t *text, long iterations)
+{
+	static char utf8[4096 * 3];
+	long n;
+
+	for (n = 0; n < iterations; n++)
+		sink += (DWORD)WideToUtf8(text, utf8, sizeof(utf8));
+}
+
+static void BenchUtf8ToWideAscii(long iterations)
+{
+	BenchUtf8ToWide(asciiText, iterations);
+}
+
+static void BenchUtf8ToWideMixed(long iterations)
+{
+	BenchUtf8ToWide(mixedText, iterations);
+}
+
+static void BenchWideToUtf8Ascii(long iterations)
+{
+	BenchWideToUtf8(asciiWide, iterations);
+}
+
+static void BenchWideToUtf8Mixed(long iterations)
+{
+	BenchWideToUtf8(mixedWide, iterations);
+}
+
+static void BenchNamesToWide(int corpus, long iterations)
+{
+	wchar_t wide[128];
+	long n;
+	int i;
+
+	for (n = 0; n < iterations; n++)
+		for (i = 0; i < CORPUS_NAMES; i++)
+			sink += (DWORD)Utf8ToWide(nameCorpora[corpus][i], wide, 128);
+}
+
+static void BenchNamesToUtf8(int corpus, long iterations)
+{
+	char utf8[384];
+	long n;
+	int i;
+
+	for (n = 0; n < iterations; n++)
+		for (i = 0; i < CORPUS_NAMES; i++)
+			sink += (DWORD)WideToUtf8(wideCorpora[corpus][i], utf8, sizeof(utf8));
+}
+
+static void BenchUtf8ToWideAsciiNames(long iterations)
+{
+	BenchNamesToWide(CORPUS_ASCII, iterations);
+}
+
+static void BenchUtf8ToWideLatinNames(long iterations)
+{
+	BenchNamesToWide(CORPUS_LATIN, iterations);
+}
+
+static void BenchUtf8ToWideCjkNames(long iterations)
+{
+	BenchNamesToWide(CORPUS_CJK, iterations);
+}
+
+static void BenchUtf8ToWideEmojiNames(long iterations)
+{
+	BenchNamesToWide(CORPUS_EMOJI, iterations);
+}
+
+static void BenchWideToUtf8AsciiNames(long iterations)
+{
+	BenchNamesToUtf8(CORPUS_ASCII, iterations);
+}
+
+static void BenchWideToUtf8LatinNames(long iterations)
+{
+	BenchNamesToUtf8(CORPUS_LATIN, iterations);
+}
+
+static void BenchWideToUtf8CjkNames(long iterations)
+{
+	BenchNamesToUtf8(CORPUS_CJK, iterations);
+}
+
+static void BenchWideToUtf8EmojiNames(long iterations)
+{
+	BenchNamesToUtf8(CORPUS_EMOJI, iterations);
+}
+
+static void BenchStrchr(long iterations)
+{
+	long n;
+
+	for (n = 0; n < iterations; n++)
+		sink += xstrchr(asciiText, '\n') != NULL;
+}
+
+static void BenchStrrchr(long iterations)
+{
+	long n;
+	size_t i;
+
+	for (n = 0; n < iterations; n++)
+		for (i = 0; i < PATH_COUNT; i++)
+			sink += (DWORD)(xstrrchr(encodedPaths[i], '/') - encodedPaths[i]);
+}
+
+static void BenchMemchr(long iterations)
+{
+	long n;
+
+	for (n = 0; n < iterations; n++)
+		sink += xmemchr(asciiText, '\n', sizeof(asciiText) - 1) != NULL;
+}
+
+static void BenchScanDelim(long iterations)
+{
+	long n;
+	size_t i;
+
+	for (n = 0; n < iterations; n++)
+		for (i = 0; i < PATH_COUNT; i++)
+		{
+			const char *p = encodedPaths[i], *end = p + strlen(p);
+
+			/* the way UrlDecode walks a target: run, escape, run */
+			while (p < end)
+			{
+				p += xscandelim(p, end - p);
+				if (p < end)
+					p += *p == '%' ? 3 : 1;
+			}
+			sink += (DWORD)(p - encodedPaths[i]);
+		}
+}
+
+static void BenchStrihash(long iterations)
+{
+	long n;
+	size_t i;
+
+	for (n = 0; n < iterations; n++)
+		for (i = 0; i < HEADER_NAME_COUNT; i++)
+			sink += xstrihash(headerNames[i]);
+}
+
+static void BenchStrnicmp(long iterations)
+{
+	long n;
+	size_t i;
+
+	for (n = 0; n < iterations; n++)
+		for (i = 0; i < HEADER_NAME_COUNT; i++)
+			sink += (DWORD)xstrnicmp(headerNames[i], "accept-encoding", strlen(headerNames[i]));
+}
+
+static benchmark smallTableBenchmarks[] = {
+	{ "HttpParseRequest", BenchParseRequest, &requestBytes },
+	{ "HttpParseRequest/split", BenchParseRequestSplit, &requestBytes },
+	{ "HttpFindHeader", BenchFindHeader, NULL },
+	{ "UrlDecode", BenchUrlDecode, &pathBytes },
+	{ "HexToInt", BenchHexToInt, &hexBytes },
+	{ "LoadMimeTypes/mime.txt", BenchLoadSmallMime, &smallMimeBytes },
+	{ "GetMimeType/mime.txt", BenchGetMimeType, &nameBytes },
+	{ "Utf8ToWide/ascii", BenchUtf8ToWideAscii, &textBytes },
+	{ "Utf8ToWide/mixed", BenchUtf8ToWideMixed, &textBytes },
+	{ "WideToUtf8/ascii", BenchWideToUtf8Ascii, &textBytes },
+	{ "WideToUtf8/mixed", BenchWideToUtf8Mixed, &textBytes },
+	{ "Utf8ToWide/names-ascii", BenchUtf8ToWideAsciiNames, &corpusBytes[CORPUS_ASCII] },
+	{ "Utf8ToWide/names-latin", BenchUtf8ToWideLatinNames, &corpusBytes[CORPUS_LATIN] },
+	{ "Utf8ToWide/names-cjk", BenchUtf8ToWideCjkNames, &corpusBytes[CORPUS_CJK] },
+	{ "Utf8ToWide/names-emoji", BenchUtf8ToWideEmojiNames, &corpusBytes[CORPUS_EMOJI] },
+	{ "WideToUtf8/names-ascii", BenchWideToUtf8AsciiNames, &corpusBytes[CORPUS_ASCII] },
+	{ "WideToUtf8/names-latin", BenchWideToUtf8LatinNames, &corpusBytes[CORPUS_LATIN] },
+	{ "WideToUtf8/names-cjk", BenchWideToUtf8CjkNames, &corpusBytes[CORPUS_CJK] },
+	{ "WideToUtf8/names-emoji", BenchWideToUtf8EmojiNames, &corpusBytes[CORPUS_EMOJI] },
+	{ "xstrchr/4k", BenchStrchr, &textBytes },
+	{ "xstrrchr/paths", BenchStrrchr, &pathBytes },
+	{ "xmemchr/4k", BenchMemchr, &textBytes },
+	{ "xscandelim/paths", BenchScanDelim, &pathBytes },
+	{ "xstrihash/headers", BenchStrihash, &headerNameBytes },
+	{ "xstrnicmp/headers", BenchStrnicmp, NULL }
+};
+
+static benchmark largeTableBenchmarks[] = {
+	{ "LoadMimeTypes/large", BenchLoadLargeMime, &largeMimeBytes },
+	{ "GetMimeType/large", BenchGetMimeTypeLarge, &nameBytes }
+};
+
+/* setup */
+
+static void BuildTexts(void)
+{
+	static const char *pieces[] = { "Report ", "Отчёт ", "报告 ", "Überblick ", "🎉 ", "naïve café " };
+	size_t length = 0, i = 0;
+
+	memset(asciiText, 'x', sizeof(asciiText) - 1);
+	for (i = 63; i < sizeof(asciiText) - 1; i += 64)
+		asciiText[i] = ' ';
+	asciiText[sizeof(asciiText) - 2] = '\n';
+
+	for (i = 0; ; i++)
+	{
+		const char *piece = pieces[i % (sizeof(pieces) / sizeof(pieces[0]))];
+		size_t pieceLength = strlen(piece);
+
+		if (length + pieceLength >= sizeof(mixedText))
+			break;
+		memcpy(mixedText + length, piece, pieceLength);
+		length += pieceLength;
+	}
+	mixedText[length] = '\0';
+
+	Utf8ToWide(asciiText, asciiWide, 4096);
+	Utf8ToWide(mixedText, mixedWide, 4096);
+
+	/* throughput is counted in UTF-8 bytes both ways, so the scripts compare directly */
+	for (i = 0; i < CORPUS_COUNT; i++)
+	{
+		int j;
+
+		for (j = 0; j < CORPUS_NAMES; j++)
+		{
+			corpusBytes[i] += strlen(nameCorpora[i][j]);
+			if (!Utf8ToWide(nameCorpora[i][j], wideCorpora[i][j], 128))
+				fprintf(stderr, "bad corpus name %s\n", nameCorpora[i][j]);
+		}
+	}
+}
+
+/* the shipped types plus a few thousand made up ones, written to a temporary file */
+static int BuildLargeMimeTable(const char *smallPath)
+{
+	FILE *in = fopen(smallPath, "rb"), *out;
+	char line[256];
+	int i;
+
+	strcpy(largeMimePath, "/tmp/tinyhttp-bench-mime-XXXXXX");
+	i = mkstemp(largeMimePath);
+	if (i < 0)
+		return 0;
+	out = fdopen(i, "wb");
+	if (!out)
+		return 0;
+
+	for (i = 0; i < 4000; i++)
+		fprintf(out, "x%dext=application/x-bench-%d\r\n", i, i);
+	if (in)
+	{
+		while (fgets(line, sizeof(line), in))
+			fputs(line, out);
+		fclose(in);
+	}
+
+	fclose(out);
+	return 1;
+}
+
+static void SetupCorpora(void)
+{
+	size_t i;
+
+	for (i = 0; i < REQUEST_COUNT; i++)
+		requestBytes += strlen(requests[i]);
+	for (i = 0; i < PATH_COUNT; i++)
+		pathBytes += strlen(encodedPaths[i]);
+	for (i = 0; i < NAME_COUNT; i++)
+		nameBytes += strlen(fileNames[i]);
+	for (i = 0; i < HEADER_NAME_COUNT; i++)
+		headerNameBytes += strlen(headerNames[i]);
+
+	HttpInitRequest(&parsedRequest);
+	HttpParseRequest(&parsedRequest, requests[0], (int)strlen(requests[0]), BUFFER_SIZE - 1);
+
+	BuildTexts();
+}
+
+/* measurement */
+
+static int CompareDoubles(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static void Run(const benchmark *bench, int repetitions, double target)
+{
+	double samples[MAX_SAMPLES], start, elapsed, median, mean = 0, deviation = 0;
+	long iterations = 1;
+	int i;
+
+	/* find a batch size that takes the target time, which warms caches and predictors on the way */
+	while (1)
+	{
+		start = Now();
+		bench->run(iterations);
+		elapsed = Now() - start;
+
+		if (elapsed >= target)
+			break;
+		if (elapsed < target / 16)
+			iterations *= 8;
+		else
+			iterations = (long)(iterations * target / elapsed) + 1;
+	}
+
+	for (i = 0; i < repetitions; i++)
+	{
+		start = Now();
+		bench->run(iterations);
+		samples[i] = (Now() - start) / iterations;
+		mean += samples[i];
+	}
+	mean /= repetitions;
+
+	for (i = 0; i < repetitions; i++)
+		deviation += (samples[i] - mean) * (samples[i] - mean);
+	deviation = repetitions > 1 ? deviation / (repetitions - 1) : 0;
+
+	qsort(samples, repetitions, sizeof(double), CompareDoubles);
+	median = samples[repetitions / 2];
+
+	printf("%-26s %12.1f %12.1f %7.1f%%", bench->name, median, samples[0],
+		   mean > 0 ? 100.0 * sqrt(deviation) / mean : 0);
+	if (bench->bytes && *bench->bytes > 0)
+		printf(" %12.1f", *bench->bytes / median * 1e9 / (1 << 20));
+	printf("\n");
+}
+
+static void RunAll(const benchmark *benches, int count, const char *filter, int repetitions, double target)
+{
+	int i;
+
+	for (i = 0; i < count; i++)
+		if (!filter || strstr(benches[i].name, filter))
+			Run(&benches[i], repetitions, target);
+}
+
+static double FileBytes(const char *path)
+{
+	FILE *f = fopen(path, "rb");
+	long size;
+
+	if (!f)
+		return 0;
+	fseek(f, 0, SEEK_END);
+	size = ftell(f);
+	fclose(f);
+	return size > 0 ? (double)size : 0;
+}
+
+int main(int argc, char *argv[])
+{
+	const char *filter = NULL;
+	int repetitions = 15, i;
+	double target = 10e6;
+
+	for (i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "-r") == 0 && i + 1 < argc)
+			repetitions = atoi(argv[++i]);
+		else if (strcmp(argv[i], "-t") == 0 && i + 1 < argc)
+			target = atof(argv[++i]) * 1e6;
+		else if (strcmp(argv[i], "-m") == 0 && i + 1 < argc)
+			smallMimePath = argv[++i];
+		else if (argv[i][0] == '-')
+		{
+			fprintf(stderr, "usage: %s [-r repetitions] [-t milliseconds] [-m mime.txt] [filter]\n", argv[0]);
+			return 2;
+		}
+		else
+			filter = argv[i];
+	}
+
+	if (repetitions < 1)
+		repetitions = 1;
+	if (repetitions > MAX_SAMPLES)
+		repetitions = MAX_SAMPLES;
+	if (target <= 0)
+		target = 10e6;
+
+	SetupCorpora();
+
+	if (!LoadMimeTypes(smallMimePath))
+	{
+		fprintf(stderr, "cannot load %s, run from the top of the tree or pass -m\n", smallMimePath);
+		return 1;
+	}
+	smallMimeBytes = FileBytes(smallMimePath);
+
+	if (!BuildLargeMimeTable(smallMimePath))
+	{
+		fprintf(stderr, "cannot write the large MIME table\n");
+		return 1;
+	}
+	largeMimeBytes = FileBytes(largeMimePath);
+
+	printf("%d samples of %.0f ms each, SIMD level %d\n\n", repetitions, target / 1e6,
+#ifdef USE_SIMD
+		   SimdLevel()
+#else
+		   0
+#endif
+		   );
+	printf("%-26s %12s %12s %8s %12s\n", "benchmark", "median ns/op", "min ns/op", "stddev", "MB/s");
+
+	RunAll(smallTableBenchmarks, sizeof(smallTableBenchmarks) / sizeof(smallTableBenchmarks[0]),
+		   filter, repetitions, target);
+
+	FreeMimeTypes();
+	LoadMimeTypes(largeMimePath);
+	RunAll(largeTableBenchmarks, sizeof(largeTableBenchmarks) / sizeof(largeTableBenchmarks[0]),
+		   filter, repetitions, target);
+
+	remove(largeMimePath);
+	return 0;
+}
@@ -0,0 +1,514 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+
+/*
+ * HTTP load generator for Linux. Every connection gets its own thread and
+ * sends GET requests for the given paths in turn.
+ *
+ * Closed loop (the default): each connection sends its next request as
+ * soon as the last response is in.
+ *
+ * Open loop (-r): requests are scheduled at a fixed total rate, and the
+ * latency is measured from when a request was due rather than from when
+ * it was sent, so a stalled server cannot hide its queueing delay.
+ *
+ *   cc -O2 -pthread -o bench/loadgen bench/loadgen.c
+ *   bench/loadgen [-c connections] [-d seconds] [-w seconds] [-r requests/s]
+ *                 [-k 0|1] [-p server pid] [-l label] [-H] host port path...
+ *
+ * A path starting with @ names a file with one path per line. The result
+ * is one table row: throughput, latency percentiles in microseconds, and
+ * with -p the server's CPU time per request. The exit status is 1 if no
+ * request was answered.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MAX_CONNECTIONS 4096
+#define RESPONSE_BUFFER 65536
+
+/* four buckets per power of two, the same layout as the server's histograms */
+#define LATENCY_BUCKETS 124
+
+typedef struct {
+	unsigned long counts[LATENCY_BUCKETS];
+	unsigned long count;
+	unsigned long long sum;
+	unsigned long max;
+} histogram;
+
+typedef struct {
+	pthread_t thread;
+	int id;
+	histogram latency;
+	unsigned long requests;
+	unsigned long failures;
+	unsigned long errors;
+	unsigned long long bytes;
+} worker;
+
+static struct sockaddr_storage address;
+static socklen_t addressLength;
+static char hostHeader[300];
+static char **paths;
+static int pathCount;
+static int connections = 16, keepAlive = 1;
+static double duration = 10, warmup = 2, rate;
+static double startTime, measureTime, endTime;
+
+static double Now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void SleepUntil(double when)
+{
+	struct timespec ts;
+
+	ts.tv_sec = (time_t)when;
+	ts.tv_nsec = (long)((when - ts.tv_sec) * 1e9);
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR);
+}
+
+static int BucketIndex(unsigned long value)
+{
+	int shift = 0;
+
+	if (value < 4)
+		return (int)value;
+
+	while (value >> shift > 7)
+		shift++;
+
+	return (shift + 1) * 4 + (int)((value >> shift) & 3);
+}
+
+static unsigned long long BucketLimit(int i)
+{
+	int shift = i / 4 - 1;
+
+	if (i < 4)
+		return i + 1;
+
+	return ((unsigned long long)(4 + i % 4) << shift) + (1ULL << shift);
+}
+
+static void AddLatency(histogram *h, unsigned long micros)
+{
+	if (micros > 0xFFFFFFFFUL)
+		micros = 0xFFFFFFFFUL;
+
+	h->counts[BucketIndex(micros ? micros - 1 : 0)]++;
+	h->count++;
+	h->sum += micros;
+	if (micros > h->max)
+		h->max = micros;
+}
+
+static unsigned long Percentile(const histogram *h, double fraction)
+{
+	unsigned long long rank, seen = 0, limit;
+	int i;
+
+	if (!h->count)
+		return 0;
+
+	rank = (unsigned long long)(h->count * fraction + 0.999999);
+	for (i = 0; i < LATENCY_BUCKETS - 1; i++)
+	{
+		seen += h->counts[i];
+		if (seen >= rank)
+			break;
+	}
+
+	limit = BucketLimit(i);
+	return limit < h->max ? (unsigned long)limit : h->max;
+}
+
+static int Connect(void)
+{
+	int fd = socket(address.ss_family, SOCK_STREAM, 0), one = 1;
+
+	if (fd < 0)
+		return -1;
+
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+	if (connect(fd, (struct sockaddr *)&address, addressLength) != 0)
+	{
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+static int SendAll(int fd, const char *data, size_t length)
+{
+	while (length > 0)
+	{
+		ssize_t sent = send(fd, data, length, MSG_NOSIGNAL);
+
+		if (sent <= 0)
+			return 0;
+		data += sent;
+		length -= (size_t)sent;
+	}
+
+	return 1;
+}
+
+/* the value of a header in a terminated head, or NULL */
+static const char *FindHeader(const char *head, const char *name)
+{
+	size_t length = strlen(name);
+	const char *line = strstr(head, "\r\n");
+
+	while (line && line[2] != '\r')
+	{
+		line += 2;
+		if (strncasecmp(line, name, length) == 0 && line[length] == ':')
+		{
+			line += length + 1;
+			while (*line == ' ')
+				line++;
+			return line;
+		}
+		line = strstr(line, "\r\n");
+	}
+
+	return NULL;
+}
+
+/*
+ * Reads one response, headers and body. Returns the status code, or 0 if
+ * the connection failed. *closing is set when the server will close it.
+ */
+static int ReadResponse(int fd, char *buffer, unsigned long long *bytes, int *closing)
+{
+	size_t have = 0;
+	char *end = NULL;
+	const char *value;
+	unsigned long long length, body;
+	int status;
+
+	while (!end)
+	{
+		ssize_t n;
+
+		if (have >= RESPONSE_BUFFER - 1)
+			return 0;
+
+		n = recv(fd, buffer + have, RESPONSE_BUFFER - 1 - have, 0);
+		if (n <= 0)
+			return 0;
+
+		have += (size_t)n;
+		buffer[have] = '\0';
+		end = strstr(buffer, "\r\n\r\n");
+	}
+
+	end[2] = '\0';
+	if (sscanf(buffer, "HTTP/1.%*d %d", &status) != 1)
+		return 0;
+
+	value = FindHeader(buffer, "Connection");
+	*closing = value && strncasecmp(value, "close", 5) == 0;
+
+	value = FindHeader(buffer, "Content-Length");
+	if (!value)
+		return 0;
+	length = strtoull(value, NULL, 10);
+
+	body = have - (size_t)(end + 4 - buffer);
+	*bytes += have;
+
+	while (body < length)
+	{
+		size_t want = length - body > RESPONSE_BUFFER ? RESPONSE_BUFFER : (size_t)(length - body);
+		ssize_t n = recv(fd, buffer, want, 0);
+
+		if (n <= 0)
+			return 0;
+		body += (unsigned long long)n;
+		*bytes += (unsigned long long)n;
+	}
+
+	/* a pipelined server never sends more than was asked for */
+	return status;
+}
+
+static void *WorkerThread(void *param)
+{
+	worker *w = (worker *)param;
+	char *buffer = malloc(RESPONSE_BUFFER), request[2048];
+	double interval = rate > 0 ? connections / rate : 0;
+	double next = startTime + (rate > 0 ? interval * w->id / connections : 0);
+	int fd = -1, index = w->id % pathCount;
+
+	if (!buffer)
+		return NULL;
+
+	while (1)
+	{
+		double due, now = Now(), finished;
+		unsigned long long bytes = 0;
+		int length, status, closing = 0;
+
+		if (rate > 0)
+		{
+			if (next >= endTime || now >= endTime)
+				break;
+			if (now < next)
+				SleepUntil(next);
+			due = next;
+			next += interval;
+		}
+		else
+		{
+			if (now >= endTime)
+				break;
+			due = now;
+		}
+
+		if (fd < 0 && (fd = Connect()) < 0)
+		{
+			w->failures++;
+			continue;
+		}
+
+		length = snprintf(request, sizeof(request), "GET %s HTTP/1.1\r\nHost: %s\r\n%s\r\n",
+						  paths[index], hostHeader, keepAlive ? "" : "Connection: close\r\n");
+		index = (index + 1) % pathCount;
+
+		status = SendAll(fd, request, (size_t)length) ? ReadResponse(fd, buffer, &bytes, &closing) : 0;
+		finished = Now();
+
+		if (!status)
+		{
+			w->failures++;
+			shutdown(fd, SHUT_RDWR);
+			close(fd);
+			fd = -1;
+			continue;
+		}
+
+		/* an overloaded server falls behind the schedule, its late answers still count */
+		if (finished >= measureTime && finished < endTime)
+		{
+			w->requests++;
+			w->bytes += bytes;
+			if (status >= 400)
+				w->errors++;
+			AddLatency(&w->latency, (unsigned long)((finished - due) * 1e6));
+		}
+
+		if (closing || !keepAlive)
+		{
+			close(fd);
+			fd = -1;
+		}
+	}
+
+	if (fd >= 0)
+		close(fd);
+	free(buffer);
+	return NULL;
+}
+
+/* user plus system time of a process in seconds, or -1 */
+static double ProcessCpu(long pid)
+{
+	char path[64], text[1024], *p;
+	unsigned long user, system;
+	FILE *f;
+	size_t n;
+
+	snprintf(path, sizeof(path), "/proc/%ld/stat", pid);
+	f = fopen(path, "r");
+	if (!f)
+		return -1;
+	n = fread(text, 1, sizeof(text) - 1, f);
+	fclose(f);
+	text[n] = '\0';
+
+	/* the command name may contain spaces, the fields after it do not */
+	p = strrchr(text, ')');
+	if (!p || sscanf(p + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu", &user, &system) != 2)
+		return -1;
+
+	return (double)(user + system) / sysconf(_SC_CLK_TCK);
+}
+
+static int AddPath(const char *path)
+{
+	char **grown = realloc(paths, (pathCount + 1) * sizeof(char *));
+
+	if (!grown)
+		return 0;
+	paths = grown;
+	paths[pathCount] = strdup(path);
+	return paths[pathCount++] != NULL;
+}
+
+static int AddPathFile(const char *name)
+{
+	char line[4096];
+	FILE *f = fopen(name, "r");
+
+	if (!f)
+		return 0;
+
+	while (fgets(line, sizeof(line), f))
+	{
+		line[strcspn(line, "\r\n")] = '\0';
+		if (*line && !AddPath(line))
+			break;
+	}
+
+	fclose(f);
+	return 1;
+}
+
+static void Usage(const char *name)
+{
+	fprintf(stderr, "usage: %s [-c connections] [-d seconds] [-w seconds] [-r requests/s]\n"
+			"       [-k 0|1] [-p server pid] [-l label] [-H] host port path|@file...\n", name);
+	exit(2);
+}
+
+int main(int argc, char *argv[])
+{
+	static worker workers[MAX_CONNECTIONS];
+	struct addrinfo hints, *result;
+	histogram total;
+	unsigned long requests = 0, failures = 0, errors = 0;
+	unsigned long long bytes = 0;
+	const char *label = "-", *host, *port;
+	double cpuBefore = -1, cpuAfter = -1, elapsed;
+	long pid = 0;
+	int header = 0, i, j, opt;
+
+	while ((opt = getopt(argc, argv, "c:d:w:r:k:p:l:H")) != -1)
+	{
+		switch (opt)
+		{
+		case 'c': connections = atoi(optarg); break;
+		case 'd': duration = atof(optarg); break;
+		case 'w': warmup = atof(optarg); break;
+		case 'r': rate = atof(optarg); break;
+		case 'k': keepAlive = atoi(optarg); break;
+		case 'p': pid = atol(optarg); break;
+		case 'l': label = optarg; break;
+		case 'H': header = 1; break;
+		default: Usage(argv[0]);
+		}
+	}
+
+	if (header)
+		printf("%-24s %6s %10s %10s %9s %9s %9s %9s %8s %8s\n", "label", "conns", "req/s", "MB/s",
+			   "p50 us", "p99 us", "p999 us", "max us", "cpu us", "errors");
+
+	if (argc - optind < 3)
+	{
+		if (header && argc == optind)
+			return 0;
+		Usage(argv[0]);
+	}
+	if (connections < 1 || connections > MAX_CONNECTIONS || duration <= 0 || warmup < 0)
+		Usage(argv[0]);
+
+	host = argv[optind];
+	port = argv[optind + 1];
+	for (i = optind + 2; i < argc; i++)
+		if (!(argv[i][0] == '@' ? AddPathFile(argv[i] + 1) : AddPath(argv[i])))
+		{
+			fprintf(stderr, "cannot read %s\n", argv[i]);
+			return 1;
+		}
+	if (!pathCount)
+	{
+		fprintf(stderr, "no paths to request\n");
+		return 1;
+	}
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_socktype = SOCK_STREAM;
+	if (getaddrinfo(host, port, &hints, &result) != 0)
+	{
+		fprintf(stderr, "cannot resolve %s\n", host);
+		return 1;
+	}
+	memcpy(&address, result->ai_addr, result->ai_addrlen);
+	addressLength = result->ai_addrlen;
+	freeaddrinfo(result);
+	snprintf(hostHeader, sizeof(hostHeader), "%s:%s", host, port);
+
+	startTime = Now();
+	measureTime = startTime + warmup;
+	endTime = measureTime + duration;
+
+	for (i = 0; i < connections; i++)
+	{
+		workers[i].id = i;
+		if (pthread_create(&workers[i].thread, NULL, WorkerThread, &workers[i]) != 0)
+		{
+			fprintf(stderr, "cannot start connection %d\n", i);
+			return 1;
+		}
+	}
+
+	if (pid)
+	{
+		SleepUntil(measureTime);
+		cpuBefore = ProcessCpu(pid);
+		SleepUntil(endTime);
+		cpuAfter = ProcessCpu(pid);
+	}
+
+	memset(&total, 0, sizeof(total));
+	for (i = 0; i < connections; i++)
+	{
+		worker *w = &workers[i];
+
+		pthread_join(w->thread, NULL);
+		requests += w->requests;
+		failures += w->failures;
+		errors += w->errors;
+		bytes += w->bytes;
+
+		for (j = 0; j < LATENCY_BUCKETS; j++)
+			total.counts[j] += w->latency.counts[j];
+		total.count += w->latency.count;
+		total.sum += w->latency.sum;
+		if (w->latency.max > total.max)
+			total.max = w->latency.max;
+	}
+
+	elapsed = duration;
+	printf("%-24s %6d %10.0f %10.1f %9lu %9lu %9lu %9lu ", label, connections,
+		   requests / elapsed, bytes / elapsed / (1 << 20),
+		   Percentile(&total, 0.50), Percentile(&total, 0.99), Percentile(&total, 0.999), total.max);
+	if (cpuBefore >= 0 && cpuAfter >= 0 && requests)
+		printf("%8.1f", (cpuAfter - cpuBefore) * 1e6 / requests);
+	else
+		printf("%8s", "-");
+	printf(" %8lu\n", errors + failures);
+
+	/* the driver waits for the server with this */
+	return requests ? 0 : 1;
+}
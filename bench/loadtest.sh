@@ -0,0 +1,175 @@
+#!/bin/sh
+# SPDX-License-Identifier: GPL-2.0-or-later
+#
+# Runs tinyhttp under Wine on the local machine against a synthetic www
+# tree and prints throughput, latency and CPU tables for every engine and
+# send path, driving it with bench/loadgen over loopback.
+#
+#   bench/loadtest.sh path/to/tinyhttp.exe [results file]
+#
+# Settings come from the environment:
+#   WINE         command that runs the server (default wine, empty to run it directly)
+#   PORT         port to serve on (default 8080)
+#   DURATION     measured seconds per run (default 10)
+#   WARMUP       unmeasured seconds before each run (default 2)
+#   CONCURRENCY  closed loop connection counts (default "1 4 16 64 256")
+#   RATES        open loop request rates, with 64 connections (default "1000 5000 20000")
+#   SMALL_FILES  number of small files (default 2000)
+#   HUGE_MB      size of each of the three huge files (default 1024)
+#   DIR_ENTRIES  entries in the big directory (default 50000)
+#   CONFIGS      server settings to compare, name:key=value,... (see below)
+#
+# The tree is created once in www/loadtest next to the executable. The
+# server's tinyhttp.ini is replaced while the runs last and restored
+# afterwards. CPU per request is the server process only, time spent in
+# wineserver is not included.
+
+set -e
+
+SERVER=${1:?usage: $0 path/to/tinyhttp.exe [results file]}
+RESULTS=${2:-loadtest-results.txt}
+WINE=${WINE-wine}
+PORT=${PORT:-8080}
+DURATION=${DURATION:-10}
+WARMUP=${WARMUP:-2}
+CONCURRENCY=${CONCURRENCY:-"1 4 16 64 256"}
+RATES=${RATES:-"1000 5000 20000"}
+SMALL_FILES=${SMALL_FILES:-2000}
+HUGE_MB=${HUGE_MB:-1024}
+DIR_ENTRIES=${DIR_ENTRIES:-50000}
+CONFIGS=${CONFIGS:-"iocp:engine=iocp threads:engine=threads pool:engine=pool
+iocp-buffered:engine=iocp,zerocopy=0,respcache_budget=0 iocp-nocache:engine=iocp,respcache_budget=0
+iocp-blocking:engine=iocp,zerocopy=0,respcache_budget=0,async_reads=0,iocp_batch=1
+iocp-mmap:engine=iocp,mmap_min=1048576 iocp-nagle:engine=iocp,zerocopy=0,respcache_budget=0,nodelay=0"}
+
+BENCH=$(cd "$(dirname "$0")" && pwd)
+SERVERDIR=$(cd "$(dirname "$SERVER")" && pwd)
+SERVERNAME=$(basename "$SERVER")
+TREE="$SERVERDIR/www/loadtest"
+WORK=$(mktemp -d)
+LOADGEN="$BENCH/loadgen"
+INI="$SERVERDIR/tinyhttp.ini"
+PID=
+SERVERPID=
+
+if [ ! -x "$LOADGEN" ] || [ "$BENCH/loadgen.c" -nt "$LOADGEN" ]; then
+	cc -O2 -pthread -o "$LOADGEN" "$BENCH/loadgen.c"
+fi
+
+cleanup() {
+	[ -n "$PID" ] && kill "$SERVERPID" "$PID" 2>/dev/null || true
+	if [ -f "$WORK/tinyhttp.ini" ]; then
+		mv "$WORK/tinyhttp.ini" "$INI"
+	else
+		rm -f "$INI"
+	fi
+	rm -rf "$WORK"
+}
+[ -f "$INI" ] && cp "$INI" "$WORK/tinyhttp.ini"
+trap cleanup EXIT INT TERM
+
+build_tree() {
+	[ -f "$TREE/.complete" ] && return
+	echo "creating the test tree in $TREE"
+	rm -rf "$TREE"
+	mkdir -p "$TREE/small" "$TREE/huge" "$TREE/dir"
+
+	# small files of 1 to 16 KB with the usual web extensions
+	i=0
+	while [ $i -lt "$SMALL_FILES" ]; do
+		set -- html css js json png jpg svg txt
+		shift $((i % 8))
+		head -c $((1024 + (i * 1531) % 15360)) /dev/urandom > "$TREE/small/file$i.$1"
+		i=$((i + 1))
+	done
+
+	# sparse, so creating them is instant; reads still go through the file system
+	for i in 1 2 3; do
+		truncate -s "${HUGE_MB}M" "$TREE/huge/file$i.bin"
+	done
+
+	(cd "$TREE/dir" && seq -f "entry%05g.txt" 1 "$DIR_ENTRIES" | xargs touch)
+	touch "$TREE/.complete"
+}
+
+write_paths() {
+	ls "$TREE/small" | sed 's|^|/loadtest/small/|' > "$WORK/small.txt"
+	ls "$TREE/huge" | sed 's|^|/loadtest/huge/|' > "$WORK/huge.txt"
+	echo /loadtest/dir/ > "$WORK/dir.txt"
+}
+
+start_server() {
+	{
+		echo "[tinyhttp]"
+		echo "port=$PORT"
+		echo "log_level=0"
+		echo "stats_interval=0"
+		echo "$1" | tr ',' '\n'
+	} > "$INI"
+
+	(cd "$SERVERDIR" && exec $WINE "./$SERVERNAME" > "$WORK/server.log" 2>&1) &
+	PID=$!
+
+	# wait until it answers
+	i=0
+	until "$LOADGEN" -c 1 -d 0.2 -w 0 127.0.0.1 "$PORT" / > /dev/null 2>&1; do
+		i=$((i + 1))
+		if [ $i -gt 300 ]; then
+			echo "the server did not start, see $WORK/server.log" >&2
+			exit 1
+		fi
+		sleep 0.1
+	done
+
+	# under Wine the process serving requests is not the one that was started,
+	# it is the newest one named after the executable (cut to 15 characters)
+	SERVERPID=$(pgrep -n -x "$(printf %.15s "$SERVERNAME")" || echo "$PID")
+}
+
+stop_server() {
+	kill "$SERVERPID" "$PID" 2>/dev/null || true
+	wait "$PID" 2>/dev/null || true
+	PID=
+	sleep 1
+}
+
+# run paths [loadgen options]
+run() {
+	paths=$1
+	shift
+	"$LOADGEN" -d "$DURATION" -w "$WARMUP" -p "$SERVERPID" "$@" 127.0.0.1 "$PORT" "$paths" | tee -a "$RESULTS"
+}
+
+build_tree
+write_paths
+: > "$RESULTS"
+
+for config in $CONFIGS; do
+	name=${config%%:*}
+	settings=${config#*:}
+
+	start_server "$settings"
+	echo "== $name ($settings)" | tee -a "$RESULTS"
+	"$LOADGEN" -H | tee -a "$RESULTS"
+
+	for c in $CONCURRENCY; do
+		run "@$WORK/small.txt" -c "$c" -l "small closed"
+	done
+	for r in $RATES; do
+		run "@$WORK/small.txt" -c 64 -r "$r" -l "small open $r/s"
+	done
+	for c in 1 4 16; do
+		run "@$WORK/small.txt" -c "$c" -l "small no keep-alive" -k 0
+	done
+	for c in 1 4 16; do
+		run "@$WORK/huge.txt" -c "$c" -l "huge closed"
+	done
+	for c in 1 4 16; do
+		run "@$WORK/dir.txt" -c "$c" -l "big dir closed"
+	done
+
+	stop_server
+	echo | tee -a "$RESULTS"
+done
+
+echo "results written to $RESULTS"
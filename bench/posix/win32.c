@@ -0,0 +1,125 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "windows.h"
+
+/* file handles are descriptors plus one, so a zero handle is never valid */
+#define TO_FD(h) ((int)((ptrdiff_t)(h) - 1))
+#define TO_HANDLE(fd) ((HANDLE)(ptrdiff_t)((fd) + 1))
+
+HANDLE GetProcessHeap(void)
+{
+	return NULL;
+}
+
+LPVOID HeapAlloc(HANDLE heap, DWORD flags, size_t bytes)
+{
+	(void)heap;
+	return (flags & HEAP_ZERO_MEMORY) ? calloc(1, bytes) : malloc(bytes);
+}
+
+BOOL HeapFree(HANDLE heap, DWORD flags, LPVOID memory)
+{
+	(void)heap;
+	(void)flags;
+	free(memory);
+	return TRUE;
+}
+
+HANDLE CreateFileA(const char *name, DWORD access, DWORD share, LPVOID security,
+				   DWORD disposition, DWORD flags, HANDLE templateFile)
+{
+	int fd;
+
+	(void)access;
+	(void)share;
+	(void)security;
+	(void)disposition;
+	(void)flags;
+	(void)templateFile;
+
+	fd = open(name, O_RDONLY);
+	return fd < 0 ? INVALID_HANDLE_VALUE : TO_HANDLE(fd);
+}
+
+DWORD GetFileSize(HANDLE file, LPDWORD high)
+{
+	struct stat st;
+
+	if (fstat(TO_FD(file), &st) != 0)
+		return INVALID_FILE_SIZE;
+	if (high)
+		*high = (DWORD)((DWORDLONG)st.st_size >> 32);
+	return (DWORD)st.st_size;
+}
+
+BOOL ReadFile(HANDLE file, LPVOID buffer, DWORD bytes, LPDWORD done, OVERLAPPED *overlapped)
+{
+	DWORD total = 0;
+
+	(void)overlapped;
+
+	while (total < bytes)
+	{
+		ssize_t n = read(TO_FD(file), (char *)buffer + total, bytes - total);
+
+		if (n < 0)
+			return FALSE;
+		if (n == 0)
+			break;
+		total += (DWORD)n;
+	}
+
+	if (done)
+		*done = total;
+	return TRUE;
+}
+
+BOOL CloseHandle(HANDLE handle)
+{
+	return close(TO_FD(handle)) == 0;
+}
+
+/* there is no console, ConsoleWrite output is dropped */
+HANDLE GetStdHandle(DWORD which)
+{
+	(void)which;
+	return INVALID_HANDLE_VALUE;
+}
+
+BOOL WriteConsoleW(HANDLE console, const void *buffer, DWORD chars, LPDWORD written, LPVOID reserved)
+{
+	(void)console;
+	(void)buffer;
+	(void)chars;
+	(void)written;
+	(void)reserved;
+	return FALSE;
+}
+
+int lstrlenA(const char *s)
+{
+	return (int)strlen(s);
+}
+
+int lstrlenW(const wchar_t *s)
+{
+	int n = 0;
+
+	while (s[n])
+		n++;
+	return n;
+}
+
+int lstrcmpiA(const char *a, const char *b)
+{
+	return strcasecmp(a, b);
+}
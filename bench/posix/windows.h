@@ -0,0 +1,59 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+
+/*
+ * Just enough of the Win32 API to build the request path modules on POSIX
+ * systems for the benchmarks. Build with -fshort-wchar so wchar_t is the
+ * 16 bit type the code expects.
+ */
+
+#ifndef BENCH_WINDOWS_H
+#define BENCH_WINDOWS_H
+
+#include <stddef.h>
+
+typedef int BOOL;
+typedef unsigned char BYTE;
+typedef unsigned short WORD;
+typedef unsigned int DWORD;
+typedef int LONG;
+typedef unsigned long long DWORDLONG;
+#define UInt32x32To64(a, b) ((DWORDLONG)(DWORD)(a) * (DWORDLONG)(DWORD)(b))
+typedef size_t ULONG_PTR;
+typedef size_t DWORD_PTR;
+typedef size_t UINT_PTR;
+typedef void *HANDLE;
+typedef void *LPVOID;
+typedef DWORD *LPDWORD;
+typedef void OVERLAPPED;
+
+#define WINAPI
+#define TRUE 1
+#define FALSE 0
+
+#define INVALID_HANDLE_VALUE ((HANDLE)(ptrdiff_t)-1)
+#define INVALID_FILE_SIZE 0xFFFFFFFF
+#define GENERIC_READ 0x80000000
+#define FILE_SHARE_READ 0x00000001
+#define OPEN_EXISTING 3
+#define FILE_ATTRIBUTE_NORMAL 0x00000080
+#define HEAP_ZERO_MEMORY 0x00000008
+#define STD_OUTPUT_HANDLE ((DWORD)-11)
+
+HANDLE GetProcessHeap(void);
+LPVOID HeapAlloc(HANDLE heap, DWORD flags, size_t bytes);
+BOOL HeapFree(HANDLE heap, DWORD flags, LPVOID memory);
+
+HANDLE CreateFileA(const char *name, DWORD access, DWORD share, LPVOID security,
+				   DWORD disposition, DWORD flags, HANDLE templateFile);
+DWORD GetFileSize(HANDLE file, LPDWORD high);
+BOOL ReadFile(HANDLE file, LPVOID buffer, DWORD bytes, LPDWORD done, OVERLAPPED *overlapped);
+BOOL CloseHandle(HANDLE handle);
+
+HANDLE GetStdHandle(DWORD which);
+BOOL WriteConsoleW(HANDLE console, const void *buffer, DWORD chars, LPDWORD written, LPVOID reserved);
+
+int lstrlenA(const char *s);
+int lstrlenW(const wchar_t *s);
+int lstrcmpiA(const char *a, const char *b);
+
+#endif
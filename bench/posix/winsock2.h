@@ -0,0 +1,10 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+
+#ifndef BENCH_WINSOCK2_H
+#define BENCH_WINSOCK2_H
+
+#include "windows.h"
+
+typedef UINT_PTR SOCKET;
+
+#endif
@@ -0,0 +1,8 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+
+/* nothing from here is needed by the benchmarked code */
+
+#ifndef BENCH_WS2TCPIP_H
+#define BENCH_WS2TCPIP_H
+
+#endif
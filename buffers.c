@@ -0,0 +1,206 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+
+#include "tinyhttp.h"
+#include "buffers.h"
+
+/* request buffer followed by the file buffer, see InitConnection */
+static blockPool connectionBuffers;
+
+/* scratch blocks, one per thread that handles requests */
+static blockPool scratchBlocks;
+static DWORD tlsIndex = TLS_OUT_OF_INDEXES;
+
+/* the heap pointer is kept in front of the aligned block */
+static void *AllocAligned(int size)
+{
+	char *raw = (char *)HeapAlloc(GetProcessHeap(), 0, size + CACHE_LINE + sizeof(void *));
+	char *block;
+
+	if (!raw)
+		return NULL;
+
+	block = (char *)(((DWORD_PTR)raw + sizeof(void *) + CACHE_LINE - 1) & ~(DWORD_PTR)(CACHE_LINE - 1));
+	((void **)block)[-1] = raw;
+	return block;
+}
+
+static void FreeAligned(void *block)
+{
+	HeapFree(GetProcessHeap(), 0, ((void **)block)[-1]);
+}
+
+void InitBlockPool(blockPool *pool, int size, int maxFree)
+{
+	InitializeCriticalSection(&pool->lock);
+	pool->free = NULL;
+	pool->freeCount = 0;
+	pool->maxFree = maxFree > 0 ? maxFree : 0;
+	pool->size = size;
+	pool->inUse = 0;
+	pool->reused = 0;
+	pool->created = 0;
+}
+
+void *GetBlock(blockPool *pool)
+{
+	void *block;
+
+	EnterCriticalSection(&pool->lock);
+	block = pool->free;
+	if (block)
+	{
+		/* free blocks are linked through their first pointer */
+		pool->free = *(void **)block;
+		pool->freeCount--;
+		pool->reused++;
+		pool->inUse++;
+	}
+	LeaveCriticalSection(&pool->lock);
+
+	if (block)
+		return block;
+
+	block = AllocAligned(pool->size);
+	if (!block)
+		return NULL;
+
+	EnterCriticalSection(&pool->lock);
+	pool->created++;
+	pool->inUse++;
+	LeaveCriticalSection(&pool->lock);
+	return block;
+}
+
+void PutBlock(blockPool *pool, void *block)
+{
+	int keep;
+
+	if (!block)
+		return;
+
+	EnterCriticalSection(&pool->lock);
+	pool->inUse--;
+	keep = pool->freeCount < pool->maxFree;
+	if (keep)
+	{
+		*(void **)block = pool->free;
+		pool->free = block;
+		pool->freeCount++;
+	}
+	LeaveCriticalSection(&pool->lock);
+
+	if (!keep)
+		FreeAligned(block);
+}
+
+/* size bytes aligned for any type, or NULL when the arena is full */
+void *ArenaAlloc(arena *scratch, int size)
+{
+	char *p;
+
+	size = (size + 7) & ~7;
+	if (!scratch || size > scratch->size - scratch->used)
+		return NULL;
+
+	p = scratch->base + scratch->used;
+	scratch->used += size;
+	return p;
+}
+
+void InitBuffers(int maxFree)
+{
+	InitBlockPool(&connectionBuffers, BUFFER_SIZE * 2, maxFree);
+	InitBlockPool(&scratchBlocks, sizeof(arena) + SCRATCH_SIZE, maxFree);
+	tlsIndex = TlsAlloc();
+}
+
+char *GetConnectionBuffers(void)
+{
+	return (char *)GetBlock(&connectionBuffers);
+}
+
+void PutConnectionBuffers(char *buffers)
+{
+	PutBlock(&connectionBuffers, buffers);
+}
+
+/* the calling thread's scratch arena, emptied; NULL if there is no memory for one */
+arena *ThreadScratch(void)
+{
+	arena *scratch;
+
+	if (tlsIndex == TLS_OUT_OF_INDEXES)
+		return NULL;
+
+	scratch = (arena *)TlsGetValue(tlsIndex);
+	if (!scratch)
+	{
+		scratch = (arena *)GetBlock(&scratchBlocks);
+		if (!scratch)
+			return NULL;
+
+		scratch->base = (char *)(scratch + 1);
+		scratch->size = SCRATCH_SIZE;
+		TlsSetValue(tlsIndex, scratch);
+	}
+
+	scratch->used = 0;
+	return scratch;
+}
+
+/*
+ * size bytes from the top of the calling thread's arena without emptying
+ * it, for code below the request handler that has no connection at hand.
+ * Falls back to the heap for threads without an arena or when it is full.
+ */
+void *GetScratch(int size)
+{
+	arena *scratch = tlsIndex != TLS_OUT_OF_INDEXES ? (arena *)TlsGetValue(tlsIndex) : NULL;
+	void *p = ArenaAlloc(scratch, size);
+
+	return p ? p : HeapAlloc(GetProcessHeap(), 0, size);
+}
+
+/* gives back the most recent GetScratch */
+void PutScratch(void *p, int size)
+{
+	arena *scratch = tlsIndex != TLS_OUT_OF_INDEXES ? (arena *)TlsGetValue(tlsIndex) : NULL;
+
+	if (!p)
+		return;
+
+	size = (size + 7) & ~7;
+	if (scratch && (char *)p >= scratch->base && (char *)p < scratch->base + scratch->size)
+	{
+		if ((char *)p + size == scratch->base + scratch->used)
+			scratch->used -= size;
+	}
+	else
+		HeapFree(GetProcessHeap(), 0, p);
+}
+
+/* hands the scratch block of a thread about to exit to the next one */
+void ScratchThreadDone(void)
+{
+	arena *scratch;
+
+	if (tlsIndex == TLS_OUT_OF_INDEXES)
+		return;
+
+	scratch = (arena *)TlsGetValue(tlsIndex);
+	if (!scratch)
+		return;
+
+	TlsSetValue(tlsIndex, NULL);
+	PutBlock(&scratchBlocks, scratch);
+}
+
+void GetBufferStats(bufferStats *stats)
+{
+	EnterCriticalSection(&connectionBuffers.lock);
+	stats->inUse = connectionBuffers.inUse;
+	stats->free = connectionBuffers.freeCount;
+	stats->reused = connectionBuffers.reused;
+	stats->created = connectionBuffers.created;
+	LeaveCriticalSection(&connectionBuffers.lock);
+}
@@ -0,0 +1,56 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+
+#ifndef BUFFERS_H
+#define BUFFERS_H
+
+/* blocks start on a cache line so two threads never share one */
+#define CACHE_LINE 64
+
+/* per-request scratch memory, enough for a directory listing or the stats page */
+#define SCRATCH_SIZE 32768
+
+/*
+ * Blocks of one size, recycled through a free list instead of going back
+ * to the heap. At most maxFree blocks are kept, the rest are freed.
+ */
+typedef struct {
+	CRITICAL_SECTION lock;
+	void *free;
+	int freeCount;
+	int maxFree;
+	int size;
+	int inUse;
+	DWORD reused;
+	DWORD created;
+} blockPool;
+
+/* bump pointer allocation, everything is released at once by resetting it */
+typedef struct arena {
+	char *base;
+	int size;
+	int used;
+} arena;
+
+typedef struct {
+	int inUse;
+	int free;
+	DWORD reused;
+	DWORD created;
+} bufferStats;
+
+void InitBlockPool(blockPool *pool, int size, int maxFree);
+void *GetBlock(blockPool *pool);
+void PutBlock(blockPool *pool, void *block);
+
+void *ArenaAlloc(arena *scratch, int size);
+
+void InitBuffers(int maxFree);
+char *GetConnectionBuffers(void);
+void PutConnectionBuffers(char *buffers);
+arena *ThreadScratch(void);
+void *GetScratch(int size);
+void PutScratch(void *p, int size);
+void ScratchThreadDone(void);
+void GetBufferStats(bufferStats *stats);
+
+#endif
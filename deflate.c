@@ -0,0 +1,252 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+
+#include "tinyhttp.h"
+#include "deflate.h"
+
+/*
+ * A small gzip writer for precompressing static files (RFC 1951/1952).
+ * Matches are found greedily through hash chains over a 32 KB window and
+ * the whole file goes into one block coded with the fixed Huffman tables,
+ * which keeps the encoder short at the price of a few percent of ratio.
+ */
+
+#define WINDOW_SIZE 32768
+#define WINDOW_MASK (WINDOW_SIZE - 1)
+#define HASH_SIZE 32768
+#define MIN_MATCH 3
+#define MAX_MATCH 258
+#define MAX_CHAIN 128
+
+typedef struct {
+	unsigned char *out;
+	DWORD size;
+	DWORD length;
+	DWORD bits;
+	int count;
+} bitWriter;
+
+static const unsigned short lengthBase[29] = {
+	3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+	35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+};
+static const unsigned char lengthExtra[29] = {
+	0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+	3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+};
+static const unsigned short distanceBase[30] = {
+	1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+	257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577
+};
+static const unsigned char distanceExtra[30] = {
+	0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+	7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13
+};
+
+static DWORD crcTable[256];
+
+/* builds the CRC-32 table, call once before compressing from several threads */
+void InitGzip(void)
+{
+	DWORD c;
+	int i, k;
+
+	for (i = 0; i < 256; i++)
+	{
+		c = (DWORD)i;
+		for (k = 0; k < 8; k++)
+			c = (c & 1) ? 0xEDB88320 ^ (c >> 1) : c >> 1;
+		crcTable[i] = c;
+	}
+}
+
+static DWORD Crc32(const unsigned char *p, DWORD length)
+{
+	DWORD crc = 0xFFFFFFFF;
+
+	while (length--)
+		crc = crcTable[(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+
+	return crc ^ 0xFFFFFFFF;
+}
+
+/* the largest output for length input bytes: every byte a 9 bit literal, plus header and trailer */
+DWORD GzipBound(DWORD length)
+{
+	return length + (length >> 3) + 64;
+}
+
+static void PutByte(bitWriter *w, DWORD value)
+{
+	if (w->length < w->size)
+		w->out[w->length] = (unsigned char)value;
+	w->length++;
+}
+
+/* extra bits go out least significant bit first */
+static void PutBits(bitWriter *w, DWORD value, int count)
+{
+	w->bits |= value << w->count;
+	w->count += count;
+	while (w->count >= 8)
+	{
+		PutByte(w, w->bits & 0xFF);
+		w->bits >>= 8;
+		w->count -= 8;
+	}
+}
+
+/* Huffman codes go out most significant bit first */
+static void PutCode(bitWriter *w, DWORD code, int length)
+{
+	DWORD reversed = 0;
+	int i;
+
+	for (i = 0; i < length; i++)
+	{
+		reversed = (reversed << 1) | (code & 1);
+		code >>= 1;
+	}
+	PutBits(w, reversed, length);
+}
+
+/* a literal/length symbol in the fixed code */
+static void PutSymbol(bitWriter *w, int symbol)
+{
+	if (symbol < 144)
+		PutCode(w, 0x30 + symbol, 8);
+	else if (symbol < 256)
+		PutCode(w, 0x190 + symbol - 144, 9);
+	else if (symbol < 280)
+		PutCode(w, symbol - 256, 7);
+	else
+		PutCode(w, 0xC0 + symbol - 280, 8);
+}
+
+static void PutMatch(bitWriter *w, int length, int distance)
+{
+	int i;
+
+	for (i = 28; lengthBase[i] > length; i--)
+		;
+	PutSymbol(w, 257 + i);
+	PutBits(w, length - lengthBase[i], lengthExtra[i]);
+
+	for (i = 29; distanceBase[i] > distance; i--)
+		;
+	PutCode(w, i, 5);
+	PutBits(w, distance - distanceBase[i], distanceExtra[i]);
+}
+
+static DWORD Hash(const unsigned char *p)
+{
+	return (((DWORD)p[0] << 10) ^ ((DWORD)p[1] << 5) ^ p[2]) & (HASH_SIZE - 1);
+}
+
+/* gzip of in into out, false if out is too small or there is no memory for the match tables */
+int GzipCompress(const unsigned char *in, DWORD length, unsigned char *out, DWORD outSize, DWORD *outLength)
+{
+	static const unsigned char header[10] = { 0x1F, 0x8B, 8, 0, 0, 0, 0, 0, 0, 0xFF };
+	bitWriter w;
+	LONG *head, *prev;
+	DWORD pos, crc, i;
+
+	head = (LONG *)HeapAlloc(GetProcessHeap(), 0, HASH_SIZE * sizeof(LONG));
+	prev = (LONG *)HeapAlloc(GetProcessHeap(), 0, WINDOW_SIZE * sizeof(LONG));
+	if (!head || !prev)
+	{
+		if (head)
+			HeapFree(GetProcessHeap(), 0, head);
+		if (prev)
+			HeapFree(GetProcessHeap(), 0, prev);
+		return 0;
+	}
+
+	for (i = 0; i < HASH_SIZE; i++)
+		head[i] = -1;
+
+	w.out = out;
+	w.size = outSize;
+	w.length = 0;
+	w.bits = 0;
+	w.count = 0;
+
+	for (i = 0; i < sizeof(header); i++)
+		PutByte(&w, header[i]);
+
+	/* the only block: final, fixed codes */
+	PutBits(&w, 1, 1);
+	PutBits(&w, 1, 2);
+
+	pos = 0;
+	while (pos < length)
+	{
+		DWORD best = 0, distance = 0, end;
+
+		if (pos + MIN_MATCH <= length)
+		{
+			DWORD limit = length - pos < MAX_MATCH ? length - pos : MAX_MATCH;
+			LONG candidate = head[Hash(in + pos)];
+			int chain = MAX_CHAIN;
+
+			while (candidate >= 0 && pos - (DWORD)candidate <= WINDOW_SIZE && chain-- > 0)
+			{
+				const unsigned char *a = in + candidate, *b = in + pos;
+				DWORD n = 0;
+				LONG next;
+
+				while (n < limit && a[n] == b[n])
+					n++;
+
+				if (n > best)
+				{
+					best = n;
+					distance = pos - (DWORD)candidate;
+					if (n == limit)
+						break;
+				}
+
+				/* a slot reused by a newer position ends the chain */
+				next = prev[candidate & WINDOW_MASK];
+				if (next >= candidate)
+					break;
+				candidate = next;
+			}
+		}
+
+		if (best >= MIN_MATCH)
+			PutMatch(&w, (int)best, (int)distance);
+		else
+		{
+			PutSymbol(&w, in[pos]);
+			best = 1;
+		}
+
+		/* every position covered goes into the chains */
+		for (end = pos + best; pos < end; pos++)
+		{
+			if (pos + MIN_MATCH <= length)
+			{
+				DWORD hash = Hash(in + pos);
+
+				prev[pos & WINDOW_MASK] = head[hash];
+				head[hash] = (LONG)pos;
+			}
+		}
+	}
+
+	PutSymbol(&w, 256);
+	if (w.count)
+		PutBits(&w, 0, 8 - w.count);
+
+	crc = Crc32(in, length);
+	for (i = 0; i < 4; i++)
+		PutByte(&w, (crc >> (i * 8)) & 0xFF);
+	for (i = 0; i < 4; i++)
+		PutByte(&w, (length >> (i * 8)) & 0xFF);
+
+	HeapFree(GetProcessHeap(), 0, head);
+	HeapFree(GetProcessHeap(), 0, prev);
+
+	*outLength = w.length;
+	return w.length <= outSize;
+}
@@ -0,0 +1,10 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+
+#ifndef DEFLATE_H
+#define DEFLATE_H
+
+void InitGzip(void);
+DWORD GzipBound(DWORD length);
+int GzipCompress(const unsigned char *in, DWORD length, unsigned char *out, DWORD outSize, DWORD *outLength);
+
+#endif
@@ -0,0 +1,337 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+
+#include "tinyhttp.h"
+#include "util.h"
+#include "http.h"
+
+#define S_START 0
+#define S_METHOD 1
+#define S_TARGET 2
+#define S_VERSION 3
+#define S_LINE_LF 4
+#define S_HEADER 5
+#define S_NAME 6
+#define S_VALUE_START 7
+#define S_VALUE 8
+#define S_VALUE_LF 9
+#define S_END_LF 10
+#define S_DONE 11
+
+#define BAD_REQUEST "400 Bad Request"
+#define TOO_LARGE "413 Content Too Large"
+#define URI_TOO_LONG "414 URI Too Long"
+#define HEADERS_TOO_LARGE "431 Request Header Fields Too Large"
+
+/* the tchar set of RFC 9110, allowed in methods and header names */
+static int IsTokenChar(int c)
+{
+	if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9'))
+		return 1;
+	return c && xstrchr("!#$%&'*+-.^_`|~", c) != NULL;
+}
+
+static int Fail(httpRequest *request, const char *error)
+{
+	request->state = S_DONE;
+	request->result = HTTP_ERROR;
+	request->error = error;
+	return HTTP_ERROR;
+}
+
+void HttpInitRequest(httpRequest *request)
+{
+	request->state = S_START;
+	request->result = HTTP_INCOMPLETE;
+	request->offset = 0;
+	request->mark = 0;
+	request->method.data = request->target.data = request->version.data = NULL;
+	request->method.length = request->target.length = request->version.length = 0;
+	request->headerCount = 0;
+	request->headLength = 0;
+	request->error = NULL;
+}
+
+/* the head is parsed, check its version and what it says about a body we are not going to read */
+static int CheckBody(httpRequest *request)
+{
+	const httpView *value;
+	int i;
+
+	/* first, so the answer to a bad version does not depend on the headers */
+	if (request->version.length != 8 || xstrnicmp(request->version.data, "HTTP/1.", 7) != 0 ||
+		request->version.data[7] < '0' || request->version.data[7] > '9')
+		return Fail(request, BAD_REQUEST);
+
+	if (HttpFindHeader(request, "Transfer-Encoding"))
+		return Fail(request, TOO_LARGE);
+
+	value = HttpFindHeader(request, "Content-Length");
+	if (value)
+	{
+		if (value->length == 0)
+			return Fail(request, BAD_REQUEST);
+		for (i = 0; i < value->length; i++)
+		{
+			if (value->data[i] < '0' || value->data[i] > '9')
+				return Fail(request, BAD_REQUEST);
+			if (value->data[i] != '0')
+				return Fail(request, TOO_LARGE);
+		}
+	}
+
+	request->state = S_DONE;
+	request->result = HTTP_COMPLETE;
+	return HTTP_COMPLETE;
+}
+
+/*
+ * Scans the bytes added since the last call and stops at the blank line
+ * ending the head. Returns HTTP_INCOMPLETE until then, and HTTP_ERROR with
+ * request->error set to the status line to answer with when the request is
+ * malformed or does not fit in capacity bytes. Lines may end in CRLF or LF.
+ */
+int HttpParseRequest(httpRequest *request, const char *buffer, int length, int capacity)
+{
+	int i;
+
+	if (request->state == S_DONE)
+		return request->result;
+
+	for (i = request->offset; i < length; i++)
+	{
+		int c = (unsigned char)buffer[i];
+
+		switch (request->state)
+		{
+		case S_START:
+			/* empty lines before the request line are allowed */
+			if (c == '\r' || c == '\n')
+				break;
+			if (!IsTokenChar(c))
+				return Fail(request, BAD_REQUEST);
+			request->mark = i;
+			request->state = S_METHOD;
+			break;
+
+		case S_METHOD:
+			if (c == ' ')
+			{
+				request->method.data = buffer + request->mark;
+				request->method.length = i - request->mark;
+				request->mark = i + 1;
+				request->state = S_TARGET;
+			}
+			else if (!IsTokenChar(c))
+				return Fail(request, BAD_REQUEST);
+			break;
+
+		case S_TARGET:
+			if (c > ' ' && c != 127)
+			{
+				/* ordinary bytes are skipped a vector at a time */
+				int run = (int)xscandelim(buffer + i, length - i);
+
+				if (run > 1)
+					i += run - 1;
+				if (i - request->mark >= MAX_PATH_LEN - 8)
+					return Fail(request, URI_TOO_LONG);
+			}
+			else if (c == ' ')
+			{
+				if (i == request->mark)
+					return Fail(request, BAD_REQUEST);
+				request->target.data = buffer + request->mark;
+				request->target.length = i - request->mark;
+				request->mark = i + 1;
+				request->state = S_VERSION;
+			}
+			else
+				return Fail(request, BAD_REQUEST);
+			break;
+
+		case S_VERSION:
+			if (c == '\r' || c == '\n')
+			{
+				request->version.data = buffer + request->mark;
+				request->version.length = i - request->mark;
+				request->state = c == '\r' ? S_LINE_LF : S_HEADER;
+			}
+			else if (c <= ' ' || c == 127)
+				return Fail(request, BAD_REQUEST);
+			break;
+
+		case S_LINE_LF:
+		case S_VALUE_LF:
+			if (c != '\n')
+				return Fail(request, BAD_REQUEST);
+			request->state = S_HEADER;
+			break;
+
+		case S_HEADER:
+			if (c == '\r')
+				request->state = S_END_LF;
+			else if (c == '\n')
+			{
+				request->headLength = i + 1;
+				request->offset = i + 1;
+				return CheckBody(request);
+			}
+			else if (!IsTokenChar(c))
+				/* this also rejects obsolete line folding */
+				return Fail(request, BAD_REQUEST);
+			else if (request->headerCount >= MAX_HEADERS)
+				return Fail(request, HEADERS_TOO_LARGE);
+			else
+			{
+				request->mark = i;
+				request->state = S_NAME;
+			}
+			break;
+
+		case S_NAME:
+			if (c == ':')
+			{
+				httpHeader *header = &request->headers[request->headerCount];
+
+				header->name.data = buffer + request->mark;
+				header->name.length = i - request->mark;
+				request->state = S_VALUE_START;
+			}
+			else if (!IsTokenChar(c))
+				return Fail(request, BAD_REQUEST);
+			break;
+
+		case S_VALUE_START:
+			if (c == ' ' || c == '\t')
+				break;
+			request->mark = i;
+			request->state = S_VALUE;
+			/* fall through */
+
+		case S_VALUE:
+			if (c > ' ' && c != 127)
+			{
+				int run = (int)xscandelim(buffer + i, length - i);
+
+				if (run > 1)
+					i += run - 1;
+			}
+			else if (c == '\r' || c == '\n')
+			{
+				httpHeader *header = &request->headers[request->headerCount++];
+				int end = i;
+
+				while (end > request->mark && (buffer[end - 1] == ' ' || buffer[end - 1] == '\t'))
+					end--;
+
+				header->value.data = buffer + request->mark;
+				header->value.length = end - request->mark;
+				request->state = c == '\r' ? S_VALUE_LF : S_HEADER;
+			}
+			else if ((c < ' ' && c != '\t') || c == 127)
+				return Fail(request, BAD_REQUEST);
+			break;
+
+		case S_END_LF:
+			if (c != '\n')
+				return Fail(request, BAD_REQUEST);
+			request->headLength = i + 1;
+			request->offset = i + 1;
+			return CheckBody(request);
+		}
+	}
+
+	request->offset = length;
+
+	if (length >= capacity)
+	{
+		if (request->state <= S_TARGET)
+			return Fail(request, URI_TOO_LONG);
+		return Fail(request, HEADERS_TOO_LARGE);
+	}
+
+	return HTTP_INCOMPLETE;
+}
+
+/* returns the value of the first header called name, or NULL */
+const httpView *HttpFindHeader(const httpRequest *request, const char *name)
+{
+	int i, length = lstrlenA(name);
+
+	for (i = 0; i < request->headerCount; i++)
+	{
+		const httpHeader *header = &request->headers[i];
+
+		if (header->name.length == length && xstrnicmp(header->name.data, name, length) == 0)
+			return &header->value;
+	}
+
+	return NULL;
+}
+
+int HttpViewEquals(const httpView *view, const char *text)
+{
+	int i;
+
+	for (i = 0; i < view->length; i++)
+	{
+		if (view->data[i] != text[i])
+			return 0;
+	}
+	return text[i] == '\0';
+}
+
+/* copies the view as a string, returns 0 if it had to be cut short */
+int HttpCopyView(const httpView *view, char *buffer, int size)
+{
+	int i;
+
+	for (i = 0; i < view->length && i < size - 1; i++)
+		buffer[i] = view->data[i];
+	buffer[i] = '\0';
+
+	return i == view->length;
+}
+
+int HexToInt(char c)
+{
+	if (c >= '0' && c <= '9') return c - '0';
+	if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+	if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+	return 0;
+}
+
+/* decodes a request target into at most MAX_PATH_LEN bytes, "+" becomes a space */
+void UrlDecode(char *dst, const char *src)
+{
+	char *p = dst;
+	char *end = dst + MAX_PATH_LEN - 1;
+	const char *srcEnd = src + lstrlenA(src);
+	
+	while (*src && p < end)
+	{
+		/* copy up to the next escape in one run */
+		const char *next = src + xscandelim(src, srcEnd - src);
+
+		if (next > src)
+		{
+			while (src < next && p < end)
+				*p++ = *src++;
+		}
+		else if (*src == '%' && src[1] && src[2])
+		{
+			*p++ = (char)(HexToInt(src[1]) * 16 + HexToInt(src[2]));
+			src += 3;
+		}
+		else if (*src == '+')
+		{
+			*p++ = ' ';
+			src++;
+		}
+		else
+		{
+			*p++ = *src++;
+		}
+	}
+	*p = '\0';
+}
@@ -0,0 +1,50 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+
+#ifndef HTTP_H
+#define HTTP_H
+
+#define HTTP_INCOMPLETE 0
+#define HTTP_COMPLETE 1
+#define HTTP_ERROR -1
+
+#define MAX_HEADERS 64
+
+/* a piece of the request buffer, not NUL terminated */
+typedef struct {
+	const char *data;
+	int length;
+} httpView;
+
+typedef struct {
+	httpView name;
+	httpView value;
+} httpHeader;
+
+/*
+ * Parser state for one request head. Views point into the buffer handed to
+ * HttpParseRequest, which must not move until the request is finished.
+ */
+typedef struct {
+	int state;
+	int result;
+	int offset;
+	int mark;
+	httpView method;
+	httpView target;
+	httpView version;
+	httpHeader headers[MAX_HEADERS];
+	int headerCount;
+	int headLength;
+	const char *error;
+} httpRequest;
+
+void HttpInitRequest(httpRequest *request);
+int HttpParseRequest(httpRequest *request, const char *buffer, int length, int capacity);
+const httpView *HttpFindHeader(const httpRequest *request, const char *name);
+int HttpViewEquals(const httpView *view, const char *text);
+int HttpCopyView(const httpView *view, char *buffer, int size);
+
+int HexToInt(char c);
+void UrlDecode(char *dst, const char *src);
+
+#endif
@@ -0,0 +1,779 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+
+#include "tinyhttp.h"
+#include "util.h"
+#include "stats.h"
+#include "iocp.h"
+#include "buffers.h"
+
+#ifdef _WINSOCK2API_
+
+#define IO_RECV 0
+#define IO_SEND 1
+#define IO_SEND_FILE 2
+#define IO_TRANSMIT 3
+#define IO_SEND_MAPPED 4
+
+/* completion keys, file reads complete under their own */
+#define KEY_SOCKET 0
+#define KEY_FILE 1
+
+#define SEND_POSTED 1
+#define SEND_DONE 0
+#define SEND_FAILED -1
+
+/* read-ahead chunks grow and shrink between these with the speed of the sends */
+#define READ_AHEAD_MIN BUFFER_SIZE
+#define READ_AHEAD_MAX 65536
+#define READ_AHEAD_SLOTS 2
+
+#define SLOT_EMPTY 0
+#define SLOT_READING 1
+#define SLOT_READY 2
+
+struct ioContext;
+
+/* a read-ahead buffer, filled while the one before it is being sent */
+typedef struct {
+	OVERLAPPED overlapped;
+	struct ioContext *ctx;
+	char *data;
+	DWORD length;
+	int state;
+} readSlot;
+
+/*
+ * The overlapped structure must come first, completions hand it back to us.
+ * Only the read-ahead state is shared between a send and the reads running
+ * next to it, the lock covers that and nothing else.
+ */
+typedef struct ioContext {
+	OVERLAPPED overlapped;
+	connection conn;
+	int state;
+	int chunkLength;
+	int chunkOffset;
+	TRANSMIT_FILE_BUFFERS transmitBuffers;
+	DWORD transmitHead;
+	DWORD transmitChunk;
+	DWORD headBytes;
+	HANDLE boundFile;
+	CRITICAL_SECTION lock;
+	readSlot slots[READ_AHEAD_SLOTS];
+	int fillSlot;
+	int sendSlot;
+	int readSegment;
+	DWORDLONG readPosition;
+	DWORDLONG readEnd;
+	DWORD chunkSize;
+	DWORD sendStarted;
+	int readsPending;
+	int waitingForRead;
+	int readFailed;
+	int closing;
+	struct ioContext *prev, *next;
+	DWORD idleSince;
+	int timedOut;
+} ioContext;
+
+static HANDLE completionPort;
+
+/* OVERLAPPED_ENTRY, missing from older headers */
+typedef struct {
+	ULONG_PTR key;
+	OVERLAPPED *overlapped;
+	ULONG_PTR internal;
+	DWORD bytesTransferred;
+} completionEntry;
+
+typedef BOOL (WINAPI *GetQueuedCompletionStatusExProc)(HANDLE, completionEntry *, ULONG, ULONG *, DWORD, BOOL);
+
+/* Vista and later dequeue many completions per call, older systems one at a time */
+static GetQueuedCompletionStatusExProc getCompletions;
+static int completionBatch;
+
+/* contexts are recycled, their buffers come from the connection buffer pool */
+static blockPool contexts;
+static blockPool readBuffers;
+
+/*
+ * Connections waiting for a request, oldest first. The sweeper closes the
+ * socket of any that waited longer than the idle timeout, which makes the
+ * pending receive complete with an error.
+ */
+static CRITICAL_SECTION idleLock;
+static ioContext idleList;
+static DWORD idleTimeout;
+
+static void ResetOverlapped(OVERLAPPED *overlapped)
+{
+	overlapped->Internal = 0;
+	overlapped->InternalHigh = 0;
+	overlapped->Offset = 0;
+	overlapped->OffsetHigh = 0;
+	overlapped->hEvent = NULL;
+}
+
+static void WatchIdle(ioContext *ctx)
+{
+	EnterCriticalSection(&idleLock);
+	ctx->idleSince = GetTickCount();
+	ctx->prev = idleList.prev;
+	ctx->next = &idleList;
+	idleList.prev->next = ctx;
+	idleList.prev = ctx;
+	LeaveCriticalSection(&idleLock);
+}
+
+/* returns 0 if the sweeper already closed the socket */
+static int UnwatchIdle(ioContext *ctx)
+{
+	int open;
+
+	EnterCriticalSection(&idleLock);
+	open = !ctx->timedOut;
+	if (open)
+	{
+		ctx->prev->next = ctx->next;
+		ctx->next->prev = ctx->prev;
+	}
+	LeaveCriticalSection(&idleLock);
+
+	return open;
+}
+
+static DWORD WINAPI SweepThread(LPVOID param)
+{
+	(void)param;
+
+	while (1)
+	{
+		DWORD now;
+
+		Sleep(1000);
+
+		now = GetTickCount();
+		EnterCriticalSection(&idleLock);
+		while (idleList.next != &idleList && now - idleList.next->idleSince >= idleTimeout)
+		{
+			ioContext *ctx = idleList.next;
+
+			idleList.next = ctx->next;
+			ctx->next->prev = &idleList;
+			ctx->timedOut = 1;
+			closesocket(ctx->conn.socket);
+		}
+		LeaveCriticalSection(&idleLock);
+	}
+
+	return 0;
+}
+
+static void ReleaseReadBuffers(ioContext *ctx)
+{
+	int i;
+
+	for (i = 0; i < READ_AHEAD_SLOTS; i++)
+	{
+		PutBlock(&readBuffers, ctx->slots[i].data);
+		ctx->slots[i].data = NULL;
+	}
+}
+
+static void FreeContext(ioContext *ctx)
+{
+	ReleaseReadBuffers(ctx);
+	DeleteCriticalSection(&ctx->lock);
+	PutConnectionBuffers(ctx->conn.requestBuffer);
+	PutBlock(&contexts, ctx);
+}
+
+/* forgets the previous response's transfer, its reads have all completed */
+static void ResetTransfer(ioContext *ctx)
+{
+	int i;
+
+	ctx->chunkLength = 0;
+	ctx->chunkOffset = 0;
+	ctx->boundFile = NULL;
+	for (i = 0; i < READ_AHEAD_SLOTS; i++)
+		ctx->slots[i].state = SLOT_EMPTY;
+	ctx->fillSlot = 0;
+	ctx->sendSlot = 0;
+	ctx->readSegment = -1;
+	ctx->waitingForRead = 0;
+	ctx->readFailed = 0;
+}
+
+static void CloseContext(ioContext *ctx)
+{
+	int pending;
+
+	/* closing the file cancels the reads still running */
+	FinishResponse(&ctx->conn, 0);
+	if (!ctx->timedOut)
+		CloseConnection(&ctx->conn);
+	else
+		CountConnection(-1);
+
+	/* the last of them to complete frees the context */
+	EnterCriticalSection(&ctx->lock);
+	ctx->closing = 1;
+	pending = ctx->readsPending;
+	LeaveCriticalSection(&ctx->lock);
+
+	if (!pending)
+		FreeContext(ctx);
+}
+
+static void PostRecv(ioContext *ctx)
+{
+	WSABUF wsaBuf;
+	DWORD bytesReceived, flags = 0;
+
+	wsaBuf.buf = ctx->conn.requestBuffer + ctx->conn.requestLength;
+	wsaBuf.len = BUFFER_SIZE - 1 - ctx->conn.requestLength;
+
+	ctx->state = IO_RECV;
+	ResetOverlapped(&ctx->overlapped);
+
+	if (idleTimeout)
+		WatchIdle(ctx);
+
+	if (WSARecv(ctx->conn.socket, &wsaBuf, 1, &bytesReceived, &flags, &ctx->overlapped, NULL) == SOCKET_ERROR &&
+		WSAGetLastError() != WSA_IO_PENDING)
+	{
+		if (idleTimeout)
+			UnwatchIdle(ctx);
+		CloseContext(ctx);
+	}
+}
+
+/* TransmitFile sends the header in front of the file by itself */
+static int PostTransmit(ioContext *ctx, const segment *head, const segment *range)
+{
+	connection *conn = &ctx->conn;
+	DWORDLONG position = range->offset, remaining = range->length;
+
+	if (!head)
+	{
+		position += conn->segmentSent;
+		remaining -= conn->segmentSent;
+	}
+
+	ctx->transmitHead = head ? (DWORD)head->length : 0;
+	ctx->transmitChunk = remaining > MAX_TRANSMIT ? MAX_TRANSMIT : (DWORD)remaining;
+	ctx->transmitBuffers.Head = head ? (LPVOID)head->data : NULL;
+	ctx->transmitBuffers.HeadLength = ctx->transmitHead;
+	ctx->transmitBuffers.Tail = NULL;
+	ctx->transmitBuffers.TailLength = 0;
+
+	ctx->state = IO_TRANSMIT;
+	ResetOverlapped(&ctx->overlapped);
+	ctx->overlapped.Offset = (DWORD)position;
+	ctx->overlapped.OffsetHigh = (DWORD)(position >> 32);
+
+	if (!TransmitFile(conn->socket, conn->hFile, ctx->transmitChunk, 0, &ctx->overlapped,
+					  head ? &ctx->transmitBuffers : NULL, 0) &&
+		WSAGetLastError() != WSA_IO_PENDING)
+		return SEND_FAILED;
+
+	return SEND_POSTED;
+}
+
+/* starts reads into every free slot, in file order, up to the end of the range */
+static int PostReads(ioContext *ctx)
+{
+	connection *conn = &ctx->conn;
+
+	while (ctx->readPosition < ctx->readEnd && ctx->slots[ctx->fillSlot].state == SLOT_EMPTY)
+	{
+		readSlot *slot = &ctx->slots[ctx->fillSlot];
+		DWORDLONG remaining = ctx->readEnd - ctx->readPosition;
+		DWORD length = remaining > ctx->chunkSize ? ctx->chunkSize : (DWORD)remaining;
+
+		if (!slot->data)
+		{
+			slot->data = (char *)GetBlock(&readBuffers);
+			if (!slot->data)
+				return 0;
+		}
+
+		ResetOverlapped(&slot->overlapped);
+		slot->overlapped.Offset = (DWORD)ctx->readPosition;
+		slot->overlapped.OffsetHigh = (DWORD)(ctx->readPosition >> 32);
+
+		if (!ReadFile(conn->hFile, slot->data, length, NULL, &slot->overlapped) &&
+			GetLastError() != ERROR_IO_PENDING)
+			return 0;
+
+		slot->state = SLOT_READING;
+		ctx->readsPending++;
+		ctx->readPosition += length;
+		ctx->fillSlot = (ctx->fillSlot + 1) % READ_AHEAD_SLOTS;
+	}
+
+	return 1;
+}
+
+/*
+ * Sends the oldest chunk read so far, behind the count buffers already
+ * gathered in front of it, while the following chunks are read.
+ */
+static int PostFileChunk(ioContext *ctx, int fileIndex, DWORDLONG sent, WSABUF *wsaBuf, DWORD count)
+{
+	connection *conn = &ctx->conn;
+	const segment *seg = &conn->segments[fileIndex];
+	readSlot *slot;
+	DWORD bytesSent;
+	int result = SEND_POSTED;
+
+	EnterCriticalSection(&ctx->lock);
+
+	if (ctx->readSegment != fileIndex)
+	{
+		if (ctx->boundFile != conn->hFile &&
+			!CreateIoCompletionPort(conn->hFile, completionPort, KEY_FILE, 0))
+		{
+			LeaveCriticalSection(&ctx->lock);
+			return SEND_FAILED;
+		}
+
+		ctx->boundFile = conn->hFile;
+		ctx->readSegment = fileIndex;
+		ctx->readPosition = seg->offset + sent;
+		ctx->readEnd = seg->offset + seg->length;
+	}
+
+	slot = &ctx->slots[ctx->sendSlot];
+	if (ctx->readFailed || !PostReads(ctx))
+		result = SEND_FAILED;
+	else if (slot->state != SLOT_READY)
+	{
+		/* the read completing resumes the connection, headers wait for it too */
+		ctx->waitingForRead = 1;
+	}
+	else
+	{
+		wsaBuf[count].buf = slot->data + ctx->chunkOffset;
+		wsaBuf[count].len = slot->length - ctx->chunkOffset;
+		ctx->state = IO_SEND_FILE;
+		ctx->sendStarted = GetTickCount();
+		ResetOverlapped(&ctx->overlapped);
+
+		if (WSASend(conn->socket, wsaBuf, count + 1, &bytesSent, 0, &ctx->overlapped, NULL) == SOCKET_ERROR &&
+			WSAGetLastError() != WSA_IO_PENDING)
+			result = SEND_FAILED;
+	}
+
+	LeaveCriticalSection(&ctx->lock);
+	return result;
+}
+
+/* larger reads while whole chunks leave within a clock tick, smaller ones once sends take long */
+static void AdaptChunkSize(ioContext *ctx, DWORD length)
+{
+	DWORD elapsed = GetTickCount() - ctx->sendStarted;
+
+	/* the short last piece of a range says nothing about the speed */
+	if (length < ctx->chunkSize)
+		return;
+
+	if (elapsed == 0 && ctx->chunkSize < READ_AHEAD_MAX)
+		ctx->chunkSize *= 2;
+	else if (elapsed > 50 && ctx->chunkSize > READ_AHEAD_MIN)
+		ctx->chunkSize /= 2;
+}
+
+/* posts the next piece of the response */
+static int PostSend(ioContext *ctx)
+{
+	connection *conn = &ctx->conn;
+	WSABUF wsaBuf[MAX_GATHER + 1];
+	DWORD count = 0, bytesSent;
+	const segment *seg;
+	DWORDLONG sent;
+	int i;
+
+	if (conn->segmentIndex >= conn->segmentCount)
+		return SEND_DONE;
+
+	seg = &conn->segments[conn->segmentIndex];
+
+	if (conn->sendPath == SEND_TRANSMITFILE)
+	{
+		if (!seg->data)
+			return PostTransmit(ctx, NULL, seg);
+		if (conn->segmentSent == 0 && conn->segmentIndex + 1 < conn->segmentCount && !seg[1].data)
+			return PostTransmit(ctx, seg, seg + 1);
+	}
+
+	/*
+	 * Consecutive memory segments go out in one gathered send, and so does
+	 * the first chunk of file data after them, so a small file's header
+	 * and body leave in the same packets.
+	 */
+	ctx->headBytes = 0;
+	for (i = conn->segmentIndex; i < conn->segmentCount && conn->segments[i].data && count < MAX_GATHER; i++)
+	{
+		DWORD skip = i == conn->segmentIndex ? (DWORD)conn->segmentSent : 0;
+
+		wsaBuf[count].buf = (char *)conn->segments[i].data + skip;
+		wsaBuf[count].len = (DWORD)conn->segments[i].length - skip;
+		ctx->headBytes += wsaBuf[count].len;
+		count++;
+	}
+	ctx->state = IO_SEND;
+
+	if (i < conn->segmentCount && !conn->segments[i].data && conn->sendPath != SEND_TRANSMITFILE)
+	{
+		seg = &conn->segments[i];
+		sent = i == conn->segmentIndex ? conn->segmentSent : 0;
+
+		if (conn->sendPath == SEND_MAPPED)
+		{
+			DWORDLONG remaining = seg->length - sent;
+			DWORD length;
+
+			wsaBuf[count].buf = (char *)MappedBytes(conn, seg->offset + sent, &length);
+			if (!wsaBuf[count].buf)
+				return SEND_FAILED;
+
+			wsaBuf[count].len = remaining < length ? (DWORD)remaining : length;
+			count++;
+			ctx->state = IO_SEND_MAPPED;
+		}
+		else if (conn->asyncFile)
+			return PostFileChunk(ctx, i, sent, wsaBuf, count);
+		else
+		{
+			if (ctx->chunkOffset >= ctx->chunkLength)
+			{
+				DWORDLONG remaining = seg->length - sent;
+				DWORD bytesRead, chunk = remaining > BUFFER_SIZE ? BUFFER_SIZE : (DWORD)remaining;
+
+				/* the file pointer only needs moving at the start of a range */
+				if (sent == 0)
+				{
+					LONG offsetHigh = (LONG)(seg->offset >> 32);
+
+					if (SetFilePointer(conn->hFile, (LONG)(DWORD)seg->offset, &offsetHigh, FILE_BEGIN) == INVALID_SET_FILE_POINTER &&
+						GetLastError() != NO_ERROR)
+						return SEND_FAILED;
+				}
+
+				if (!ReadFile(conn->hFile, conn->fileBuffer, chunk, &bytesRead, NULL) || bytesRead == 0)
+					return SEND_FAILED;
+
+				ctx->chunkLength = (int)bytesRead;
+				ctx->chunkOffset = 0;
+			}
+
+			wsaBuf[count].buf = conn->fileBuffer + ctx->chunkOffset;
+			wsaBuf[count].len = ctx->chunkLength - ctx->chunkOffset;
+			count++;
+			ctx->state = IO_SEND_FILE;
+		}
+	}
+
+	ResetOverlapped(&ctx->overlapped);
+
+	if (WSASend(conn->socket, wsaBuf, count, &bytesSent, 0, &ctx->overlapped, NULL) == SOCKET_ERROR &&
+		WSAGetLastError() != WSA_IO_PENDING)
+		return SEND_FAILED;
+
+	return SEND_POSTED;
+}
+
+/* sends the current response, then moves on to the next request or closes */
+static void ContinueConnection(ioContext *ctx)
+{
+	connection *conn = &ctx->conn;
+
+	while (1)
+	{
+		int result = PostSend(ctx);
+
+		if (result == SEND_POSTED)
+			return;
+
+		FinishResponse(conn, result == SEND_DONE);
+
+		/* every chunk read was sent, an idle connection keeps no read-ahead memory */
+		if (result == SEND_DONE)
+			ReleaseReadBuffers(ctx);
+
+		if (result == SEND_FAILED || !NextRequest(conn))
+			break;
+
+		/* pipelined requests may already be waiting in the buffer */
+		if (!RequestComplete(conn))
+		{
+			PostRecv(ctx);
+			return;
+		}
+
+		HandleRequest(conn);
+		ResetTransfer(ctx);
+	}
+
+	CloseContext(ctx);
+}
+
+static void CompleteIo(ioContext *ctx, DWORD bytesTransferred)
+{
+	connection *conn = &ctx->conn;
+
+	/* what went out beyond the headers gathered in front of the file data */
+	DWORD fileBytes = bytesTransferred > ctx->headBytes ? bytesTransferred - ctx->headBytes : 0;
+
+	switch (ctx->state)
+	{
+	case IO_RECV:
+		conn->requestLength += (int)bytesTransferred;
+		if (!RequestComplete(conn))
+		{
+			PostRecv(ctx);
+			return;
+		}
+
+		HandleRequest(conn);
+		ResetTransfer(ctx);
+		break;
+
+	case IO_SEND:
+		AdvanceResponse(conn, bytesTransferred);
+		break;
+
+	case IO_SEND_FILE:
+		conn->fileSent += fileBytes;
+		AdvanceResponse(conn, bytesTransferred);
+		if (!conn->asyncFile)
+		{
+			ctx->chunkOffset += (int)fileBytes;
+			break;
+		}
+
+		EnterCriticalSection(&ctx->lock);
+		ctx->chunkOffset += (int)fileBytes;
+		if ((DWORD)ctx->chunkOffset >= ctx->slots[ctx->sendSlot].length)
+		{
+			AdaptChunkSize(ctx, ctx->slots[ctx->sendSlot].length);
+			ctx->slots[ctx->sendSlot].state = SLOT_EMPTY;
+			ctx->sendSlot = (ctx->sendSlot + 1) % READ_AHEAD_SLOTS;
+			ctx->chunkOffset = 0;
+		}
+		LeaveCriticalSection(&ctx->lock);
+		break;
+
+	case IO_SEND_MAPPED:
+		conn->fileSent += fileBytes;
+		AdvanceResponse(conn, bytesTransferred);
+		break;
+
+	case IO_TRANSMIT:
+		/* TransmitFile either sends everything it was given or fails */
+		conn->fileSent += ctx->transmitChunk;
+		AdvanceResponse(conn, (DWORDLONG)ctx->transmitHead + ctx->transmitChunk);
+		break;
+	}
+
+	ContinueConnection(ctx);
+}
+
+/* a read-ahead chunk arrived, the connection resumes if its send was waiting for it */
+static void CompleteRead(readSlot *slot, DWORD bytesTransferred, BOOL ok)
+{
+	ioContext *ctx = slot->ctx;
+	int resume, release;
+
+	EnterCriticalSection(&ctx->lock);
+	ctx->readsPending--;
+	slot->length = bytesTransferred;
+	slot->state = SLOT_READY;
+	if (!ok || bytesTransferred == 0)
+		ctx->readFailed = 1;
+	release = ctx->closing && ctx->readsPending == 0;
+	resume = ctx->waitingForRead && !ctx->closing;
+	ctx->waitingForRead = 0;
+	LeaveCriticalSection(&ctx->lock);
+
+	if (release)
+		FreeContext(ctx);
+	else if (resume)
+		ContinueConnection(ctx);
+}
+
+static void DispatchCompletion(ULONG_PTR key, OVERLAPPED *overlapped, DWORD bytesTransferred, BOOL ok)
+{
+	ioContext *ctx = (ioContext *)overlapped;
+
+	if (key == KEY_FILE)
+	{
+		CompleteRead((readSlot *)overlapped, bytesTransferred, ok);
+		return;
+	}
+
+	if (ctx->state == IO_RECV && idleTimeout)
+		UnwatchIdle(ctx);
+
+	if (!ok || bytesTransferred == 0 || ctx->timedOut)
+		CloseContext(ctx);
+	else
+		CompleteIo(ctx, bytesTransferred);
+}
+
+static DWORD WINAPI EventThread(LPVOID param)
+{
+	completionEntry *entries = (completionEntry *)param;
+
+	while (1)
+	{
+		DWORD bytesTransferred;
+		ULONG_PTR key;
+		OVERLAPPED *overlapped;
+		ULONG count, i;
+		BOOL ok;
+
+		if (entries)
+		{
+			if (!getCompletions(completionPort, entries, (ULONG)completionBatch, &count, INFINITE, FALSE))
+				continue;
+
+			/* a failed operation leaves an error status in Internal */
+			for (i = 0; i < count; i++)
+				if (entries[i].overlapped)
+					DispatchCompletion(entries[i].key, entries[i].overlapped, entries[i].bytesTransferred, (LONG)entries[i].internal >= 0);
+			continue;
+		}
+
+		ok = GetQueuedCompletionStatus(completionPort, &bytesTransferred, &key, &overlapped, INFINITE);
+		if (overlapped)
+			DispatchCompletion(key, overlapped, bytesTransferred, ok);
+	}
+
+	return 0;
+}
+
+int StartEventLoop(int idleSeconds, int freeContexts, int batch)
+{
+	HMODULE kernel32 = GetModuleHandleA("kernel32.dll");
+	SYSTEM_INFO systemInfo;
+	char buffer[128];
+	DWORD i, threadCount;
+
+	completionPort = CreateIoCompletionPort(INVALID_HANDLE_VALUE, NULL, 0, 0);
+	if (!completionPort)
+		return 0;
+
+	InitBlockPool(&contexts, sizeof(ioContext), freeContexts);
+	InitBlockPool(&readBuffers, READ_AHEAD_MAX, freeContexts);
+	InitializeCriticalSection(&idleLock);
+	idleList.prev = idleList.next = &idleList;
+
+	if (idleSeconds > 0)
+	{
+		HANDLE threadHandle = CreateThread(NULL, 0, SweepThread, NULL, 0, NULL);
+		if (threadHandle)
+		{
+			idleTimeout = (DWORD)idleSeconds * 1000;
+			CloseHandle(threadHandle);
+		}
+	}
+
+	GetSystemInfo(&systemInfo);
+	threadCount = systemInfo.dwNumberOfProcessors ? systemInfo.dwNumberOfProcessors : 1;
+
+	if (kernel32 && batch > 1)
+		getCompletions = (GetQueuedCompletionStatusExProc)GetProcAddress(kernel32, "GetQueuedCompletionStatusEx");
+	completionBatch = getCompletions ? batch : 1;
+
+	for (i = 0; i < threadCount; i++)
+	{
+		HANDLE threadHandle;
+		completionEntry *entries = NULL;
+
+		if (getCompletions)
+		{
+			entries = (completionEntry *)HeapAlloc(GetProcessHeap(), 0, completionBatch * sizeof(completionEntry));
+			if (!entries)
+				break;
+		}
+
+		threadHandle = CreateThread(NULL, 0, EventThread, entries, 0, NULL);
+		if (threadHandle == NULL)
+		{
+			if (entries)
+				HeapFree(GetProcessHeap(), 0, entries);
+			break;
+		}
+		CloseHandle(threadHandle);
+	}
+
+	if (i == 0)
+	{
+		CloseHandle(completionPort);
+		return 0;
+	}
+
+	wsprintfA(buffer, "Event loop started with %lu threads, %d completions per wait\r\n", i, completionBatch);
+	ConsoleWrite(buffer);
+	return 1;
+}
+
+int AddEventConnection(SOCKET clientSocket)
+{
+	ioContext *ctx = (ioContext *)GetBlock(&contexts);
+	char *buffers;
+	int i;
+
+	if (!ctx)
+		return 0;
+
+	buffers = GetConnectionBuffers();
+	if (!buffers)
+	{
+		PutBlock(&contexts, ctx);
+		return 0;
+	}
+
+	InitConnection(&ctx->conn, clientSocket, buffers);
+	InitializeCriticalSection(&ctx->lock);
+	for (i = 0; i < READ_AHEAD_SLOTS; i++)
+	{
+		ctx->slots[i].ctx = ctx;
+		ctx->slots[i].data = NULL;
+	}
+	ResetTransfer(ctx);
+	ctx->chunkSize = READ_AHEAD_MIN;
+	ctx->readsPending = 0;
+	ctx->closing = 0;
+	ctx->timedOut = 0;
+
+	if (!CreateIoCompletionPort((HANDLE)clientSocket, completionPort, KEY_SOCKET, 0))
+	{
+		FreeContext(ctx);
+		return 0;
+	}
+
+	PostRecv(ctx);
+	return 1;
+}
+
+#else
+
+int StartEventLoop(int idleSeconds, int freeContexts, int batch)
+{
+	(void)idleSeconds;
+	(void)freeContexts;
+	(void)batch;
+	return 0;
+}
+
+int AddEventConnection(SOCKET clientSocket)
+{
+	(void)clientSocket;
+	return 0;
+}
+
+#endif
@@ -0,0 +1,9 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+
+#ifndef IOCP_H
+#define IOCP_H
+
+int StartEventLoop(int idleSeconds, int freeContexts, int batch);
+int AddEventConnection(SOCKET clientSocket);
+
+#endif
@@ -0,0 +1,228 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+
+#include "tinyhttp.h"
+#include "unicode.h"
+#include "util.h"
+#include "metacache.h"
+#include "respcache.h"
+#include "listcache.h"
+#include "buffers.h"
+
+/*
+ * Rendered directory listings. Every cached directory keeps a change
+ * notification handle that is signalled when an entry is added, removed or
+ * renamed, and a signalled handle drops the listing on its next lookup.
+ *
+ * The handle is armed before the directory is enumerated: a miss hands out
+ * a ticket and the rendered listing is only stored if nothing changed and
+ * nobody else reused the slot since, so a change that races the
+ * enumeration can never leave a stale listing behind.
+ */
+typedef struct {
+	char *path;
+	DWORD hash;
+	HANDLE change;
+	DWORD ticket;
+	DWORD lastUsed;
+	cachedResponse *response;
+} listEntry;
+
+static listEntry *entries;
+static int entryCount;
+static DWORD nextTicket;
+static CRITICAL_SECTION listLock;
+static DWORD hits, misses, invalidations;
+
+static listEntry *FindEntry(const char *path, DWORD hash)
+{
+	int i;
+
+	for (i = 0; i < entryCount; i++)
+	{
+		if (entries[i].path && entries[i].hash == hash && lstrcmpiA(entries[i].path, path) == 0)
+			return &entries[i];
+	}
+	return NULL;
+}
+
+static void DropResponse(listEntry *entry)
+{
+	if (entry->response)
+	{
+		ReleaseCachedResponse(entry->response);
+		entry->response = NULL;
+	}
+}
+
+/* a notification handle for changes to the names in a directory, or INVALID_HANDLE_VALUE */
+static HANDLE WatchDirectory(const char *path)
+{
+	wchar_t *widePath = (wchar_t *)GetScratch(MAX_PATH_LEN * sizeof(wchar_t));
+	HANDLE change = INVALID_HANDLE_VALUE;
+
+	if (widePath && Utf8ToWide(path, widePath, MAX_PATH_LEN))
+		change = FindFirstChangeNotificationW(widePath, FALSE, FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_DIR_NAME);
+	PutScratch(widePath, MAX_PATH_LEN * sizeof(wchar_t));
+	return change;
+}
+
+/*
+ * Gives the least recently used slot to path and its notification handle.
+ * The handle of the path it replaces is returned in retired, for the
+ * caller to close once the lock is released.
+ */
+static listEntry *ClaimEntry(const char *path, DWORD hash, HANDLE change, HANDLE *retired)
+{
+	listEntry *entry = &entries[0];
+	char *copy;
+	int i;
+
+	*retired = INVALID_HANDLE_VALUE;
+
+	for (i = 0; i < entryCount; i++)
+	{
+		if (!entries[i].path)
+		{
+			entry = &entries[i];
+			break;
+		}
+		if (GetTickCount() - entries[i].lastUsed > GetTickCount() - entry->lastUsed)
+			entry = &entries[i];
+	}
+
+	copy = (char *)HeapAlloc(GetProcessHeap(), 0, lstrlenA(path) + 1);
+	if (!copy)
+		return NULL;
+	lstrcpyA(copy, path);
+
+	if (entry->path)
+	{
+		DropResponse(entry);
+		*retired = entry->change;
+		HeapFree(GetProcessHeap(), 0, entry->path);
+		entry->path = NULL;
+	}
+
+	entry->path = copy;
+	entry->hash = hash;
+	entry->change = change;
+	entry->ticket = 0;
+	return entry;
+}
+
+int InitListingCache(int count)
+{
+	if (count <= 0)
+		return 1;
+
+	entries = (listEntry *)HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY, count * sizeof(listEntry));
+	if (!entries)
+		return 0;
+
+	InitializeCriticalSection(&listLock);
+	entryCount = count;
+	return 1;
+}
+
+/* returns a reference to the cached listing, or NULL and a ticket for StoreCachedListing */
+cachedResponse *FindCachedListing(const char *path, DWORD *ticket)
+{
+	DWORD hash = xstrihash(path);
+	cachedResponse *response = NULL;
+	HANDLE change = INVALID_HANDLE_VALUE, retired = INVALID_HANDLE_VALUE;
+	listEntry *entry;
+
+	*ticket = 0;
+	if (!entries)
+		return NULL;
+
+	EnterCriticalSection(&listLock);
+	entry = FindEntry(path, hash);
+
+	if (entry && WaitForSingleObject(entry->change, 0) == WAIT_OBJECT_0)
+	{
+		/* re-armed before the caller enumerates the directory again */
+		if (entry->response)
+			invalidations++;
+		DropResponse(entry);
+		FindNextChangeNotification(entry->change);
+		entry->ticket = 0;
+	}
+	else if (entry && entry->response)
+	{
+		response = entry->response;
+		InterlockedIncrement(&response->refs);
+	}
+
+	/* watching a directory can be slow, on a share above all, so not under the lock */
+	if (!entry)
+	{
+		LeaveCriticalSection(&listLock);
+		change = WatchDirectory(path);
+		EnterCriticalSection(&listLock);
+
+		/* another request may have claimed it meanwhile */
+		entry = FindEntry(path, hash);
+		if (!entry && change != INVALID_HANDLE_VALUE)
+		{
+			entry = ClaimEntry(path, hash, change, &retired);
+			if (entry)
+				change = INVALID_HANDLE_VALUE;
+		}
+	}
+
+	if (entry)
+	{
+		entry->lastUsed = GetTickCount();
+		if (!response)
+		{
+			if (!entry->ticket && ++nextTicket == 0)
+				nextTicket++;
+			if (!entry->ticket)
+				entry->ticket = nextTicket;
+			*ticket = entry->ticket;
+		}
+	}
+
+	if (response)
+		hits++;
+	else
+		misses++;
+	LeaveCriticalSection(&listLock);
+
+	if (change != INVALID_HANDLE_VALUE)
+		FindCloseChangeNotification(change);
+	if (retired != INVALID_HANDLE_VALUE)
+		FindCloseChangeNotification(retired);
+	return response;
+}
+
+void StoreCachedListing(const char *path, DWORD ticket, cachedResponse *response)
+{
+	listEntry *entry;
+
+	if (!ticket)
+		return;
+
+	EnterCriticalSection(&listLock);
+	entry = FindEntry(path, xstrihash(path));
+	if (entry && entry->ticket == ticket && !entry->response &&
+		WaitForSingleObject(entry->change, 0) == WAIT_TIMEOUT)
+	{
+		InterlockedIncrement(&response->refs);
+		entry->response = response;
+	}
+	LeaveCriticalSection(&listLock);
+}
+
+void GetListingCacheStats(listingCacheStats *stats)
+{
+	if (entries)
+		EnterCriticalSection(&listLock);
+	stats->hits = hits;
+	stats->misses = misses;
+	stats->invalidations = invalidations;
+	stats->entries = entryCount;
+	if (entries)
+		LeaveCriticalSection(&listLock);
+}
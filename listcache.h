@@ -0,0 +1,18 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+
+#ifndef LISTCACHE_H
+#define LISTCACHE_H
+
+typedef struct {
+	DWORD hits;
+	DWORD misses;
+	DWORD invalidations;
+	int entries;
+} listingCacheStats;
+
+int InitListingCache(int entries);
+cachedResponse *FindCachedListing(const char *path, DWORD *ticket);
+void StoreCachedListing(const char *path, DWORD ticket, cachedResponse *response);
+void GetListingCacheStats(listingCacheStats *stats);
+
+#endif
@@ -0,0 +1,299 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+
+#include "tinyhttp.h"
+#include "unicode.h"
+#include "util.h"
+#include "log.h"
+
+#define RING_SIZE 16384
+#define RING_MASK (RING_SIZE - 1)
+#define MAX_MESSAGE 2048
+#define BATCH_SIZE 65536
+#define FLUSH_INTERVAL 100
+
+/*
+ * Every thread that logs gets its own ring, so writers never wait on each
+ * other or on the sink. Only the owning thread moves head and only the
+ * flusher moves tail, which makes each ring lock free. Records are a two
+ * byte length followed by the text. A message that does not fit is dropped
+ * and counted rather than blocking the request that wrote it.
+ *
+ * Rings are never freed. A thread that exits puts its ring on a free list
+ * for the next thread, which carries on after any records not yet
+ * drained, so a thread per connection does not allocate one each time.
+ */
+typedef struct logRing {
+	struct logRing *next;
+	struct logRing *nextFree;
+	volatile LONG head;
+	volatile LONG tail;
+	char data[RING_SIZE];
+} logRing;
+
+static int logLevel = LOG_REQUEST;
+static int logSink = LOG_SINK_CONSOLE;
+static int started;
+static DWORD tlsIndex;
+static logRing *rings, *freeRings;
+static CRITICAL_SECTION ringsLock, flushLock, freeLock;
+static HANDLE wakeEvent, logFile = INVALID_HANDLE_VALUE;
+static LONG dropped;
+
+static char batch[BATCH_SIZE + 1];
+static wchar_t wideBatch[BATCH_SIZE + 1];
+static int batchLength;
+
+static void WriteBatch(void)
+{
+	DWORD written;
+
+	if (!batchLength)
+		return;
+	batch[batchLength] = '\0';
+
+	if (logSink == LOG_SINK_FILE)
+		WriteFile(logFile, batch, batchLength, &written, NULL);
+	else if (logSink == LOG_SINK_CONSOLE)
+	{
+		HANDLE hStdout = GetStdHandle(STD_OUTPUT_HANDLE);
+		int wLen = Utf8ToWideLossy(batch, wideBatch, BATCH_SIZE + 1);
+
+		/* WriteConsoleW fails when the output is redirected, which takes the bytes as they are */
+		if (hStdout != INVALID_HANDLE_VALUE && wLen > 0 &&
+			!WriteConsoleW(hStdout, wideBatch, wLen - 1, &written, NULL))
+			WriteFile(hStdout, batch, batchLength, &written, NULL);
+	}
+
+	batchLength = 0;
+}
+
+static void AddToBatch(const char *text, int length)
+{
+	while (length > 0)
+	{
+		int chunk = BATCH_SIZE - batchLength;
+
+		if (chunk > length)
+			chunk = length;
+
+		while (chunk--)
+		{
+			batch[batchLength++] = *text++;
+			length--;
+		}
+
+		if (batchLength == BATCH_SIZE)
+			WriteBatch();
+	}
+}
+
+static void DrainRing(logRing *ring)
+{
+	LONG head = InterlockedCompareExchange(&ring->head, 0, 0);
+	LONG tail = ring->tail;
+	char text[MAX_MESSAGE];
+
+	while (tail != head)
+	{
+		int length = ((unsigned char)ring->data[tail & RING_MASK] << 8) | (unsigned char)ring->data[(tail + 1) & RING_MASK];
+		int i;
+
+		for (i = 0; i < length; i++)
+			text[i] = ring->data[(tail + 2 + i) & RING_MASK];
+		AddToBatch(text, length);
+		tail += 2 + length;
+	}
+
+	InterlockedExchange(&ring->tail, tail);
+}
+
+/* drains every ring into as few sink writes as possible */
+static void FlushRings(void)
+{
+	logRing *ring;
+	LONG lost;
+
+	EnterCriticalSection(&flushLock);
+
+	EnterCriticalSection(&ringsLock);
+	for (ring = rings; ring; ring = ring->next)
+		DrainRing(ring);
+	LeaveCriticalSection(&ringsLock);
+
+	lost = InterlockedExchange(&dropped, 0);
+	if (lost)
+	{
+		char buffer[64];
+		AddToBatch(buffer, wsprintfA(buffer, "%ld log messages dropped\r\n", lost));
+	}
+
+	WriteBatch();
+	LeaveCriticalSection(&flushLock);
+}
+
+static DWORD WINAPI FlushThread(LPVOID param)
+{
+	(void)param;
+
+	while (1)
+	{
+		WaitForSingleObject(wakeEvent, FLUSH_INTERVAL);
+		FlushRings();
+	}
+
+	return 0;
+}
+
+/* Ctrl+C and closing the console would otherwise lose what is still queued */
+static BOOL WINAPI ConsoleHandler(DWORD ctrlType)
+{
+	(void)ctrlType;
+	FlushRings();
+	return FALSE;
+}
+
+static logRing *ThreadRing(void)
+{
+	logRing *ring = (logRing *)TlsGetValue(tlsIndex);
+
+	if (ring)
+		return ring;
+
+	EnterCriticalSection(&freeLock);
+	ring = freeRings;
+	if (ring)
+		freeRings = ring->nextFree;
+	LeaveCriticalSection(&freeLock);
+
+	if (!ring)
+	{
+		/* head and tail start at zero, the data needs no clearing */
+		ring = (logRing *)HeapAlloc(GetProcessHeap(), 0, sizeof(logRing));
+		if (!ring)
+			return NULL;
+		ring->head = ring->tail = 0;
+
+		EnterCriticalSection(&ringsLock);
+		ring->next = rings;
+		rings = ring;
+		LeaveCriticalSection(&ringsLock);
+	}
+
+	TlsSetValue(tlsIndex, ring);
+	return ring;
+}
+
+int StartLogger(int level, int sink, const wchar_t *path)
+{
+	HANDLE threadHandle;
+
+	logLevel = level;
+	logSink = sink;
+	if (sink == LOG_SINK_NONE)
+		return 1;
+
+	if (sink == LOG_SINK_FILE)
+	{
+		logFile = CreateFileW(path, FILE_APPEND_DATA, FILE_SHARE_READ, NULL, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+		if (logFile == INVALID_HANDLE_VALUE)
+		{
+			logSink = LOG_SINK_CONSOLE;
+			return 0;
+		}
+	}
+
+	tlsIndex = TlsAlloc();
+	if (tlsIndex == TLS_OUT_OF_INDEXES)
+		return 0;
+
+	InitializeCriticalSection(&ringsLock);
+	InitializeCriticalSection(&flushLock);
+	InitializeCriticalSection(&freeLock);
+	wakeEvent = CreateEventA(NULL, FALSE, FALSE, NULL);
+	if (!wakeEvent)
+		return 0;
+
+	threadHandle = CreateThread(NULL, 0, FlushThread, NULL, 0, NULL);
+	if (!threadHandle)
+		return 0;
+	CloseHandle(threadHandle);
+
+	SetConsoleCtrlHandler(ConsoleHandler, TRUE);
+	started = 1;
+	return 1;
+}
+
+void LogWrite(int level, const char *message)
+{
+	logRing *ring;
+	int length, i;
+	LONG head, used;
+
+	if (level > logLevel || logSink == LOG_SINK_NONE)
+		return;
+
+	/* until the flusher runs, and if it could not be started, write directly */
+	if (!started)
+	{
+		if (logSink == LOG_SINK_FILE)
+		{
+			DWORD written;
+			WriteFile(logFile, message, lstrlenA(message), &written, NULL);
+		}
+		else
+			ConsoleWrite(message);
+		return;
+	}
+
+	ring = ThreadRing();
+	if (!ring)
+	{
+		InterlockedIncrement(&dropped);
+		return;
+	}
+
+	length = lstrlenA(message);
+	if (length > MAX_MESSAGE)
+		length = MAX_MESSAGE;
+
+	head = ring->head;
+	used = head - InterlockedCompareExchange(&ring->tail, 0, 0);
+	if (used + 2 + length > RING_SIZE)
+	{
+		InterlockedIncrement(&dropped);
+		SetEvent(wakeEvent);
+		return;
+	}
+
+	ring->data[head & RING_MASK] = (char)(length >> 8);
+	ring->data[(head + 1) & RING_MASK] = (char)length;
+	for (i = 0; i < length; i++)
+		ring->data[(head + 2 + i) & RING_MASK] = message[i];
+
+	/* the interlocked store publishes the record after its bytes */
+	InterlockedExchange(&ring->head, head + 2 + length);
+
+	/* wake the flusher early once the ring is half full */
+	if (used <= RING_SIZE / 2 && used + 2 + length > RING_SIZE / 2)
+		SetEvent(wakeEvent);
+}
+
+/* a thread that is about to exit hands its ring to the next one, the flusher still drains it */
+void LogThreadDone(void)
+{
+	logRing *ring;
+
+	if (!started)
+		return;
+
+	ring = (logRing *)TlsGetValue(tlsIndex);
+	if (ring)
+	{
+		TlsSetValue(tlsIndex, NULL);
+
+		EnterCriticalSection(&freeLock);
+		ring->nextFree = freeRings;
+		freeRings = ring;
+		LeaveCriticalSection(&freeLock);
+	}
+}
@@ -0,0 +1,18 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+
+#ifndef LOG_H
+#define LOG_H
+
+#define LOG_ERROR 0
+#define LOG_INFO 1
+#define LOG_REQUEST 2
+
+#define LOG_SINK_NONE 0
+#define LOG_SINK_CONSOLE 1
+#define LOG_SINK_FILE 2
+
+int StartLogger(int level, int sink, const wchar_t *path);
+void LogWrite(int level, const char *message);
+void LogThreadDone(void);
+
+#endif
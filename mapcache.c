@@ -0,0 +1,215 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+
+#include "tinyhttp.h"
+#include "util.h"
+#include "metacache.h"
+#include "mapcache.h"
+
+#define MAP_BUCKETS 64
+
+/*
+ * Mappings of the large files being sent right now, looked up by path. The
+ * table holds no reference of its own: a file leaves it when the last
+ * connection sending it lets go, so only files in use take address space.
+ */
+static mappedFile *buckets[MAP_BUCKETS];
+static CRITICAL_SECTION mapLock;
+static DWORDLONG mapMinimum;
+static int mapFiles;
+static LONG opened, shared, mappedViews;
+
+/* takes the file out of the table, the caller holds mapLock */
+static void UnlinkFile(mappedFile *file)
+{
+	mappedFile **link = &buckets[file->hash % MAP_BUCKETS];
+
+	while (*link != file)
+		link = &(*link)->chain;
+	*link = file->chain;
+	file->linked = 0;
+	mapFiles--;
+}
+
+static void FreeMappedFile(mappedFile *file)
+{
+	if (file->hMapping)
+		CloseHandle(file->hMapping);
+	if (file->views)
+		HeapFree(GetProcessHeap(), 0, file->views);
+	if (file->viewRefs)
+		HeapFree(GetProcessHeap(), 0, file->viewRefs);
+	if (file->path)
+		HeapFree(GetProcessHeap(), 0, file->path);
+	DeleteCriticalSection(&file->lock);
+	HeapFree(GetProcessHeap(), 0, file);
+}
+
+int InitMapCache(DWORDLONG minimumSize)
+{
+	InitializeCriticalSection(&mapLock);
+	mapMinimum = minimumSize;
+	return 1;
+}
+
+int MapCacheable(DWORDLONG size)
+{
+	return mapMinimum && size >= mapMinimum;
+}
+
+/* a reference to the mapping another connection already uses, or NULL */
+mappedFile *FindMappedFile(const char *path, const fileInfo *info)
+{
+	DWORD hash = xstrihash(path);
+	mappedFile *file;
+
+	EnterCriticalSection(&mapLock);
+	for (file = buckets[hash % MAP_BUCKETS]; file; file = file->chain)
+	{
+		if (file->hash != hash || lstrcmpiA(file->path, path) != 0)
+			continue;
+
+		/* the file changed, its senders keep the old mapping to themselves */
+		if (file->size != info->size || CompareFileTime(&file->lastWrite, &info->lastWrite) != 0)
+		{
+			UnlinkFile(file);
+			break;
+		}
+
+		file->refs++;
+		LeaveCriticalSection(&mapLock);
+		InterlockedIncrement(&shared);
+		return file;
+	}
+	LeaveCriticalSection(&mapLock);
+	return NULL;
+}
+
+/* maps hFile, which the caller may close afterwards, and returns a reference to it */
+mappedFile *CreateMappedFile(const char *path, const fileInfo *info, HANDLE hFile)
+{
+	mappedFile *file, **link;
+
+	file = (mappedFile *)HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY, sizeof(mappedFile));
+	if (!file)
+		return NULL;
+
+	InitializeCriticalSection(&file->lock);
+	file->windowCount = (DWORD)((info->size + MAP_WINDOW - 1) >> MAP_WINDOW_SHIFT);
+	file->path = (char *)HeapAlloc(GetProcessHeap(), 0, lstrlenA(path) + 1);
+	file->views = (char **)HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY, file->windowCount * sizeof(char *));
+	file->viewRefs = (LONG *)HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY, file->windowCount * sizeof(LONG));
+	if (!file->path || !file->views || !file->viewRefs)
+	{
+		FreeMappedFile(file);
+		return NULL;
+	}
+
+	/*
+	 * Exactly the size the response announces, so a file that shrank fails
+	 * here instead of sending short. A mapped file cannot be truncated, so a
+	 * mapping found later by FindMappedFile still has all of it.
+	 */
+	file->hMapping = CreateFileMappingW(hFile, NULL, PAGE_READONLY, (DWORD)(info->size >> 32), (DWORD)info->size, NULL);
+	if (!file->hMapping)
+	{
+		FreeMappedFile(file);
+		return NULL;
+	}
+
+	lstrcpyA(file->path, path);
+	file->refs = 1;
+	file->hash = xstrihash(path);
+	file->size = info->size;
+	file->lastWrite = info->lastWrite;
+	InterlockedIncrement(&opened);
+
+	EnterCriticalSection(&mapLock);
+
+	/* another request may have mapped the same path meanwhile */
+	for (link = &buckets[file->hash % MAP_BUCKETS]; *link; link = &(*link)->chain)
+	{
+		if ((*link)->hash == file->hash && lstrcmpiA((*link)->path, path) == 0)
+		{
+			UnlinkFile(*link);
+			break;
+		}
+	}
+
+	file->chain = buckets[file->hash % MAP_BUCKETS];
+	buckets[file->hash % MAP_BUCKETS] = file;
+	file->linked = 1;
+	mapFiles++;
+
+	LeaveCriticalSection(&mapLock);
+	return file;
+}
+
+void ReleaseMappedFile(mappedFile *file)
+{
+	int last;
+
+	EnterCriticalSection(&mapLock);
+	last = --file->refs == 0;
+	if (last && file->linked)
+		UnlinkFile(file);
+	LeaveCriticalSection(&mapLock);
+
+	if (last)
+		FreeMappedFile(file);
+}
+
+/* the start of the window, mapped if no other connection has it mapped */
+const char *AcquireWindow(mappedFile *file, DWORD window)
+{
+	DWORDLONG offset = (DWORDLONG)window << MAP_WINDOW_SHIFT;
+	DWORDLONG remaining = file->size - offset;
+	char *view;
+
+	if (window >= file->windowCount)
+		return NULL;
+
+	EnterCriticalSection(&file->lock);
+	view = file->views[window];
+	if (!view)
+	{
+		view = (char *)MapViewOfFile(file->hMapping, FILE_MAP_READ, (DWORD)(offset >> 32), (DWORD)offset,
+									 remaining > MAP_WINDOW ? MAP_WINDOW : (DWORD)remaining);
+		file->views[window] = view;
+		if (view)
+			InterlockedIncrement(&mappedViews);
+	}
+	if (view)
+		file->viewRefs[window]++;
+	LeaveCriticalSection(&file->lock);
+
+	return view;
+}
+
+void ReleaseWindow(mappedFile *file, DWORD window)
+{
+	char *view = NULL;
+
+	EnterCriticalSection(&file->lock);
+	if (--file->viewRefs[window] == 0)
+	{
+		view = file->views[window];
+		file->views[window] = NULL;
+	}
+	LeaveCriticalSection(&file->lock);
+
+	if (view)
+	{
+		UnmapViewOfFile(view);
+		InterlockedDecrement(&mappedViews);
+	}
+}
+
+void GetMapCacheStats(mapCacheStats *stats)
+{
+	EnterCriticalSection(&mapLock);
+	stats->opened = (DWORD)opened;
+	stats->shared = (DWORD)shared;
+	stats->files = mapFiles;
+	stats->views = (int)mappedViews;
+	LeaveCriticalSection(&mapLock);
+}
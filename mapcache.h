@@ -0,0 +1,47 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+
+#ifndef MAPCACHE_H
+#define MAPCACHE_H
+
+/* files are mapped in windows of 4 MB, a multiple of the allocation granularity */
+#define MAP_WINDOW_SHIFT 22
+#define MAP_WINDOW ((DWORD)1 << MAP_WINDOW_SHIFT)
+#define NO_WINDOW ((DWORD)-1)
+
+/*
+ * A file mapping shared by every connection sending the same file. Each
+ * window is mapped when the first connection reaches it and unmapped when
+ * the last one moves on.
+ */
+typedef struct mappedFile {
+	struct mappedFile *chain;
+	LONG refs;
+	int linked;
+	DWORD hash;
+	char *path;
+	DWORDLONG size;
+	FILETIME lastWrite;
+	HANDLE hMapping;
+	CRITICAL_SECTION lock;
+	DWORD windowCount;
+	char **views;
+	LONG *viewRefs;
+} mappedFile;
+
+typedef struct {
+	DWORD opened;
+	DWORD shared;
+	int files;
+	int views;
+} mapCacheStats;
+
+int InitMapCache(DWORDLONG minimumSize);
+int MapCacheable(DWORDLONG size);
+mappedFile *FindMappedFile(const char *path, const fileInfo *info);
+mappedFile *CreateMappedFile(const char *path, const fileInfo *info, HANDLE hFile);
+void ReleaseMappedFile(mappedFile *file);
+const char *AcquireWindow(mappedFile *file, DWORD window);
+void ReleaseWindow(mappedFile *file, DWORD window);
+void GetMapCacheStats(mapCacheStats *stats);
+
+#endif
@@ -0,0 +1,185 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+
+#include "tinyhttp.h"
+#include "unicode.h"
+#include "util.h"
+#include "mime.h"
+#include "buffers.h"
+#include "metacache.h"
+
+#define CACHE_WAYS 4
+#define CACHE_LOCKS 16
+
+/*
+ * Set associative cache of file metadata keyed by the request path. Every
+ * set holds CACHE_WAYS entries and is guarded by one of CACHE_LOCKS striped
+ * locks, so lookups of different paths rarely contend. Entries expire after
+ * the TTL, which bounds how long a changed file can be described wrongly.
+ * Paths that name no file are cached too, for the same TTL: looking for
+ * compressed sidecars that do not exist would otherwise cost a kernel
+ * lookup each on every request for a text file.
+ */
+typedef struct {
+	char *path;
+	DWORD hash;
+	DWORD loadedAt;
+	DWORD lastUsed;
+	int missing;
+	fileInfo info;
+} metaEntry;
+
+static metaEntry *entries;
+static DWORD setCount;
+static DWORD ttl;
+static CRITICAL_SECTION locks[CACHE_LOCKS];
+static LONG hits, misses;
+
+static int StatFile(const char *path, fileInfo *info)
+{
+	WIN32_FIND_DATAW findData;
+	wchar_t *widePath = (wchar_t *)GetScratch(MAX_PATH_LEN * sizeof(wchar_t));
+	HANDLE hFind = INVALID_HANDLE_VALUE;
+
+	/* a path that is not valid UTF-8 names no file */
+	if (widePath && Utf8ToWide(path, widePath, MAX_PATH_LEN))
+		hFind = FindFirstFileW(widePath, &findData);
+	PutScratch(widePath, MAX_PATH_LEN * sizeof(wchar_t));
+
+	if (hFind == INVALID_HANDLE_VALUE)
+		return 0;
+	FindClose(hFind);
+
+	info->attributes = findData.dwFileAttributes;
+	info->size = ((DWORDLONG)findData.nFileSizeHigh << 32) | findData.nFileSizeLow;
+	info->lastWrite = findData.ftLastWriteTime;
+	info->mimeType = (findData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) ? NULL : GetMimeType(path);
+	return 1;
+}
+
+int InitMetaCache(int entryCount, int ttlSeconds)
+{
+	int i;
+
+	if (entryCount <= 0 || ttlSeconds <= 0)
+		return 1;
+
+	for (setCount = 1; setCount * CACHE_WAYS < (DWORD)entryCount; setCount *= 2);
+
+	entries = (metaEntry *)HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY, setCount * CACHE_WAYS * sizeof(metaEntry));
+	if (!entries)
+		return 0;
+
+	for (i = 0; i < CACHE_LOCKS; i++)
+		InitializeCriticalSection(&locks[i]);
+
+	ttl = (DWORD)ttlSeconds * 1000;
+	return 1;
+}
+
+int LookupFileInfo(const char *path, fileInfo *info)
+{
+	DWORD hash, set, now;
+	metaEntry *way, *victim;
+	CRITICAL_SECTION *lock;
+	int i, length, found;
+	char *copy;
+
+	if (!entries)
+		return StatFile(path, info);
+
+	hash = xstrihash(path);
+	set = hash & (setCount - 1);
+	way = entries + set * CACHE_WAYS;
+	lock = &locks[set % CACHE_LOCKS];
+	now = GetTickCount();
+
+	EnterCriticalSection(lock);
+	for (i = 0; i < CACHE_WAYS; i++)
+	{
+		if (way[i].path && way[i].hash == hash && now - way[i].loadedAt < ttl &&
+			lstrcmpiA(way[i].path, path) == 0)
+		{
+			way[i].lastUsed = now;
+			*info = way[i].info;
+			found = !way[i].missing;
+			LeaveCriticalSection(lock);
+			InterlockedIncrement(&hits);
+			return found;
+		}
+	}
+	LeaveCriticalSection(lock);
+
+	InterlockedIncrement(&misses);
+
+	found = StatFile(path, info);
+
+	length = lstrlenA(path);
+	copy = (char *)HeapAlloc(GetProcessHeap(), 0, length + 1);
+	if (!copy)
+		return found;
+	lstrcpyA(copy, path);
+
+	EnterCriticalSection(lock);
+
+	/* reuse a stale copy of the same path, else the least recently used way */
+	victim = way;
+	for (i = 0; i < CACHE_WAYS; i++)
+	{
+		if (way[i].path && way[i].hash == hash && lstrcmpiA(way[i].path, path) == 0)
+		{
+			victim = &way[i];
+			break;
+		}
+		if (!way[i].path || now - way[i].lastUsed > now - victim->lastUsed)
+			victim = &way[i];
+		if (!way[i].path)
+			break;
+	}
+
+	if (victim->path)
+		HeapFree(GetProcessHeap(), 0, victim->path);
+
+	victim->path = copy;
+	victim->hash = hash;
+	victim->loadedAt = now;
+	victim->lastUsed = now;
+	victim->missing = !found;
+	if (found)
+		victim->info = *info;
+	LeaveCriticalSection(lock);
+
+	return found;
+}
+
+/* forgets path, for a caller that found the file different from its cached description */
+void InvalidateFileInfo(const char *path)
+{
+	DWORD hash, set;
+	metaEntry *way;
+	int i;
+
+	if (!entries)
+		return;
+
+	hash = xstrihash(path);
+	set = hash & (setCount - 1);
+	way = entries + set * CACHE_WAYS;
+
+	EnterCriticalSection(&locks[set % CACHE_LOCKS]);
+	for (i = 0; i < CACHE_WAYS; i++)
+	{
+		if (way[i].path && way[i].hash == hash && lstrcmpiA(way[i].path, path) == 0)
+		{
+			HeapFree(GetProcessHeap(), 0, way[i].path);
+			way[i].path = NULL;
+		}
+	}
+	LeaveCriticalSection(&locks[set % CACHE_LOCKS]);
+}
+
+void GetMetaCacheStats(metaCacheStats *stats)
+{
+	stats->hits = (DWORD)hits;
+	stats->misses = (DWORD)misses;
+	stats->entries = (int)(setCount * CACHE_WAYS);
+}
@@ -0,0 +1,24 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+
+#ifndef METACACHE_H
+#define METACACHE_H
+
+typedef struct {
+	DWORD attributes;
+	DWORDLONG size;
+	FILETIME lastWrite;
+	const char *mimeType;
+} fileInfo;
+
+typedef struct {
+	DWORD hits;
+	DWORD misses;
+	int entries;
+} metaCacheStats;
+
+int InitMetaCache(int entries, int ttlSeconds);
+int LookupFileInfo(const char *path, fileInfo *info);
+void InvalidateFileInfo(const char *path);
+void GetMetaCacheStats(metaCacheStats *stats);
+
+#endif
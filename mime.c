@@ -15,6 +15,54 @@ struct mimeType
 	const char *mime;
 };
 
+/* open addressing table of pointers into mimeTypes, size is a power of two and at least twice the entries */
+static struct mimeType **mimeTable;
+static size_t mimeTableMask;
+
+/* the file as read, ext and mime point into it */
+static char *mimeText;
+
+static struct mimeType *FindMimeType(const char *ext)
+{
+	size_t i;
+
+	if(!mimeTable)
+		return NULL;
+
+	for(i = xstrihash(ext) & mimeTableMask; mimeTable[i]; i = (i + 1) & mimeTableMask)
+	{
+		if(lstrcmpiA(mimeTable[i]->ext, ext) == 0)
+			return mimeTable[i];
+	}
+
+	return NULL;
+}
+
+static int BuildMimeTable(void)
+{
+	size_t size = 16, i, j;
+
+	while(size < mimeTypesSize * 2)
+		size *= 2;
+
+	mimeTable = (struct mimeType **)HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY, size * sizeof(struct mimeType *));
+	if(!mimeTable)
+		return 0;
+	mimeTableMask = size - 1;
+
+	/* the first line for an extension wins, as it did with the linear scan */
+	for(i = 0; i < mimeTypesSize; i++)
+	{
+		if(!*mimeTypes[i].ext || FindMimeType(mimeTypes[i].ext))
+			continue;
+
+		for(j = xstrihash(mimeTypes[i].ext) & mimeTableMask; mimeTable[j]; j = (j + 1) & mimeTableMask);
+		mimeTable[j] = &mimeTypes[i];
+	}
+
+	return 1;
+}
+
 int LoadMimeTypes(const char *filename)
 {
 	char *p;
@@ -80,7 +128,10 @@ int LoadMimeTypes(const char *filename)
 		p += lstrlenA(p) + 1;
 	}
 
-	/* HeapFree(GetProcessHeap(), 0, hMem); */
+	if(!BuildMimeTable())
+		goto error;
+
+	mimeText = (char *)hMem;
 	CloseHandle(hFile);
 	return 1;
 
@@ -90,27 +141,49 @@ error:
 		HeapFree(GetProcessHeap(), 0, hMem);
 	if(hStructArray)
 		HeapFree(GetProcessHeap(), 0, hStructArray);
+	mimeTypes = NULL;
+	mimeTypesSize = 0;
 	return 0;
 }
 
-const char *GetMimeType(const char *filename)
+/* forgets the loaded types, strings returned by GetMimeType are freed with them */
+void FreeMimeTypes(void)
 {
-	size_t i;
-	const char *ext = NULL;
-	const char *dot = xstrrchr(filename, '.');
+	if(mimeTable)
+		HeapFree(GetProcessHeap(), 0, mimeTable);
+	if(mimeTypes)
+		HeapFree(GetProcessHeap(), 0, mimeTypes);
+	if(mimeText)
+		HeapFree(GetProcessHeap(), 0, mimeText);
+
+	mimeTable = NULL;
+	mimeTypes = NULL;
+	mimeText = NULL;
+	mimeTypesSize = 0;
+}
 
-	if(!dot)
-		goto end;
+/*
+ * Tries every suffix of the file name that starts after a dot, longest
+ * first, so "a.tar.gz" can match a "tar.gz" line before falling back to "gz".
+ */
+const char *GetMimeType(const char *filename)
+{
+	const char *name = filename, *p;
+	struct mimeType *type;
 
-	ext = dot + 1;
+	for(p = filename; *p; p++)
+	{
+		if(*p == '\\' || *p == '/')
+			name = p + 1;
+	}
 
-	for(i = 0; i < mimeTypesSize; i++)
+	for(p = xstrchr(name, '.'); p; p = xstrchr(p + 1, '.'))
 	{
-		if(lstrcmpiA(ext, mimeTypes[i].ext) == 0)
-			return mimeTypes[i].mime;
+		type = FindMimeType(p + 1);
+		if(type)
+			return type->mime;
 	}
 
-end:
 	return "application/octet-stream";
 
 #if 0
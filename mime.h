@@ -5,5 +5,6 @@
 
 int LoadMimeTypes(const char *filename);
 const char *GetMimeType(const char *filename);
+void FreeMimeTypes(void);
 
 #endif
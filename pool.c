@@ -0,0 +1,165 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+
+#include "tinyhttp.h"
+#include "util.h"
+#include "pool.h"
+#include "buffers.h"
+
+typedef struct {
+	SOCKET socket;
+	DWORD queuedAt;
+} poolItem;
+
+/*
+ * Bounded ring of accepted sockets. The lock only covers the index update,
+ * the semaphores do the blocking: workers wait for items, the accept loop
+ * waits for free slots when the queue is full.
+ */
+static poolItem *queue;
+static int queueSize, queueHead, queueTail, queueDepth;
+static CRITICAL_SECTION queueLock;
+static HANDLE itemsSemaphore, slotsSemaphore;
+
+static int poolThreads, peakDepth;
+static DWORD servedCount, totalWait, maxWait;
+
+static SOCKET DequeueConnection(void)
+{
+	poolItem item;
+	DWORD wait;
+
+	WaitForSingleObject(itemsSemaphore, INFINITE);
+
+	EnterCriticalSection(&queueLock);
+	item = queue[queueHead];
+	queueHead = (queueHead + 1) % queueSize;
+	queueDepth--;
+
+	wait = GetTickCount() - item.queuedAt;
+	servedCount++;
+	totalWait += wait;
+	if (wait > maxWait)
+		maxWait = wait;
+	LeaveCriticalSection(&queueLock);
+
+	ReleaseSemaphore(slotsSemaphore, 1, NULL);
+
+	return item.socket;
+}
+
+void QueuePoolConnection(SOCKET clientSocket)
+{
+	WaitForSingleObject(slotsSemaphore, INFINITE);
+
+	EnterCriticalSection(&queueLock);
+	queue[queueTail].socket = clientSocket;
+	queue[queueTail].queuedAt = GetTickCount();
+	queueTail = (queueTail + 1) % queueSize;
+	queueDepth++;
+	if (queueDepth > peakDepth)
+		peakDepth = queueDepth;
+	LeaveCriticalSection(&queueLock);
+
+	ReleaseSemaphore(itemsSemaphore, 1, NULL);
+}
+
+void GetPoolStats(poolStats *stats)
+{
+	if (!queue)
+	{
+		stats->threads = 0;
+		return;
+	}
+
+	EnterCriticalSection(&queueLock);
+	stats->threads = poolThreads;
+	stats->depth = queueDepth;
+	stats->peakDepth = peakDepth;
+	stats->served = servedCount;
+	stats->averageWait = servedCount ? totalWait / servedCount : 0;
+	stats->maxWait = maxWait;
+	LeaveCriticalSection(&queueLock);
+}
+
+/* each worker owns its request and file buffers for its whole lifetime */
+static DWORD WINAPI PoolThread(LPVOID param)
+{
+	connection conn;
+	char *buffers = (char *)param;
+
+	while (1)
+	{
+		InitConnection(&conn, DequeueConnection(), buffers);
+		ServeConnection(&conn);
+	}
+
+	return 0;
+}
+
+/* undoes what StartPool set up before it failed */
+static void FreeQueue(void)
+{
+	if (itemsSemaphore)
+		CloseHandle(itemsSemaphore);
+	if (slotsSemaphore)
+		CloseHandle(slotsSemaphore);
+	itemsSemaphore = slotsSemaphore = NULL;
+
+	DeleteCriticalSection(&queueLock);
+	HeapFree(GetProcessHeap(), 0, queue);
+	queue = NULL;
+}
+
+int StartPool(int threadCount, int queueLength)
+{
+	char buffer[128];
+	int i;
+
+	if (threadCount < 1)
+		threadCount = 1;
+	if (queueLength < 1)
+		queueLength = 1;
+
+	queue = (poolItem *)HeapAlloc(GetProcessHeap(), 0, queueLength * sizeof(poolItem));
+	if (!queue)
+		return 0;
+
+	queueSize = queueLength;
+	InitializeCriticalSection(&queueLock);
+	itemsSemaphore = CreateSemaphoreA(NULL, 0, queueLength, NULL);
+	slotsSemaphore = CreateSemaphoreA(NULL, queueLength, queueLength, NULL);
+	if (!itemsSemaphore || !slotsSemaphore)
+	{
+		FreeQueue();
+		return 0;
+	}
+
+	for (i = 0; i < threadCount; i++)
+	{
+		HANDLE threadHandle;
+		char *buffers = GetConnectionBuffers();
+
+		if (!buffers)
+			break;
+
+		threadHandle = CreateThread(NULL, 0, PoolThread, buffers, 0, NULL);
+		if (threadHandle == NULL)
+		{
+			PutConnectionBuffers(buffers);
+			break;
+		}
+		CloseHandle(threadHandle);
+	}
+
+	/* no thread can be waiting on the queue yet */
+	if (i == 0)
+	{
+		FreeQueue();
+		return 0;
+	}
+
+	poolThreads = i;
+	wsprintfA(buffer, "Worker pool started with %d threads, queue of %d\r\n", i, queueLength);
+	ConsoleWrite(buffer);
+	return 1;
+}
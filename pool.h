@@ -0,0 +1,19 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+
+#ifndef POOL_H
+#define POOL_H
+
+typedef struct {
+	int threads;
+	int depth;
+	int peakDepth;
+	DWORD served;
+	DWORD averageWait;
+	DWORD maxWait;
+} poolStats;
+
+int StartPool(int threadCount, int queueLength);
+void QueuePoolConnection(SOCKET clientSocket);
+void GetPoolStats(poolStats *stats);
+
+#endif
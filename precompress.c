@@ -0,0 +1,293 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+
+#include "tinyhttp.h"
+#include "unicode.h"
+#include "util.h"
+#include "mime.h"
+#include "deflate.h"
+#include "precompress.h"
+
+#define QUEUE_LENGTH 64
+#define MAX_WORKERS 64
+
+/* larger files are left alone, they are read into memory whole */
+#define PRECOMPRESS_MAX (64 << 20)
+
+/* leaves a sidecar only if it saves at least a tenth */
+#define WORTHWHILE(size, compressed) ((compressed) < (size) - (size) / 10)
+
+/*
+ * Paths waiting to be compressed, filled by the directory walk and drained
+ * by the workers. An empty path tells a worker to stop.
+ */
+static wchar_t (*queue)[MAX_PATH_LEN];
+static int queueHead, queueTail;
+static CRITICAL_SECTION queueLock;
+static HANDLE itemsSemaphore, slotsSemaphore;
+
+static LONG compressed, upToDate, skipped, failed, bytesIn, bytesOut;
+
+/* text formats compress well, images and archives already are compressed */
+int Compressible(const char *mimeType)
+{
+	const char *p;
+
+	if (!mimeType)
+		return 0;
+	if (xstrnicmp(mimeType, "text/", 5) == 0)
+		return 1;
+
+	/* application/json, image/svg+xml, application/javascript and the like */
+	for (p = mimeType; *p && *p != ';'; p++)
+	{
+		if (xstrnicmp(p, "json", 4) == 0 || xstrnicmp(p, "xml", 3) == 0 || xstrnicmp(p, "javascript", 10) == 0)
+			return 1;
+	}
+	return 0;
+}
+
+static int FindFile(const wchar_t *path, WIN32_FIND_DATAW *findData)
+{
+	HANDLE hFind = FindFirstFileW(path, findData);
+
+	if (hFind == INVALID_HANDLE_VALUE)
+		return 0;
+
+	FindClose(hFind);
+	return 1;
+}
+
+static int WriteWholeFile(const wchar_t *path, const unsigned char *data, DWORD length)
+{
+	HANDLE hFile = CreateFileW(path, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+	DWORD written;
+	BOOL ok;
+
+	if (hFile == INVALID_HANDLE_VALUE)
+		return 0;
+
+	ok = WriteFile(hFile, data, length, &written, NULL) && written == length;
+	CloseHandle(hFile);
+
+	if (!ok)
+		DeleteFileW(path);
+	return ok;
+}
+
+/* writes path.gz unless it is newer than path already; the server ignores older ones */
+static void PrecompressFile(const wchar_t *path)
+{
+	wchar_t sidecar[MAX_PATH_LEN + 4], temporary[MAX_PATH_LEN + 8];
+	WIN32_FIND_DATAW source, existing;
+	unsigned char *in = NULL, *out = NULL;
+	DWORD length, total = 0, bytesRead, outLength;
+	HANDLE hFile;
+
+	lstrcpyW(sidecar, path);
+	lstrcatW(sidecar, L".gz");
+	lstrcpyW(temporary, sidecar);
+	lstrcatW(temporary, L".tmp");
+
+	if (!FindFile(path, &source))
+	{
+		InterlockedIncrement(&failed);
+		return;
+	}
+
+	length = source.nFileSizeLow;
+	if (source.nFileSizeHigh || length == 0 || length > PRECOMPRESS_MAX)
+	{
+		InterlockedIncrement(&skipped);
+		return;
+	}
+
+	if (FindFile(sidecar, &existing) && CompareFileTime(&existing.ftLastWriteTime, &source.ftLastWriteTime) >= 0)
+	{
+		InterlockedIncrement(&upToDate);
+		return;
+	}
+
+	hFile = CreateFileW(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (hFile == INVALID_HANDLE_VALUE)
+	{
+		InterlockedIncrement(&failed);
+		return;
+	}
+
+	in = (unsigned char *)HeapAlloc(GetProcessHeap(), 0, length);
+	out = (unsigned char *)HeapAlloc(GetProcessHeap(), 0, GzipBound(length));
+	while (in && total < length && ReadFile(hFile, in + total, length - total, &bytesRead, NULL) && bytesRead)
+		total += bytesRead;
+	CloseHandle(hFile);
+
+	if (!in || !out || total != length || !GzipCompress(in, length, out, GzipBound(length), &outLength))
+		InterlockedIncrement(&failed);
+	else if (!WORTHWHILE(length, outLength))
+	{
+		/* an old sidecar would be served in place of the new contents */
+		DeleteFileW(sidecar);
+		InterlockedIncrement(&skipped);
+	}
+	else if (WriteWholeFile(temporary, out, outLength) &&
+			 MoveFileExW(temporary, sidecar, MOVEFILE_REPLACE_EXISTING))
+	{
+		InterlockedIncrement(&compressed);
+		InterlockedExchangeAdd(&bytesIn, (LONG)(length >> 10));
+		InterlockedExchangeAdd(&bytesOut, (LONG)(outLength >> 10));
+	}
+	else
+	{
+		DeleteFileW(temporary);
+		InterlockedIncrement(&failed);
+	}
+
+	if (in)
+		HeapFree(GetProcessHeap(), 0, in);
+	if (out)
+		HeapFree(GetProcessHeap(), 0, out);
+}
+
+static void QueuePath(const wchar_t *path)
+{
+	WaitForSingleObject(slotsSemaphore, INFINITE);
+
+	EnterCriticalSection(&queueLock);
+	lstrcpyW(queue[queueTail], path);
+	queueTail = (queueTail + 1) % QUEUE_LENGTH;
+	LeaveCriticalSection(&queueLock);
+
+	ReleaseSemaphore(itemsSemaphore, 1, NULL);
+}
+
+static DWORD WINAPI PrecompressThread(LPVOID param)
+{
+	wchar_t path[MAX_PATH_LEN];
+
+	(void)param;
+
+	while (1)
+	{
+		WaitForSingleObject(itemsSemaphore, INFINITE);
+
+		EnterCriticalSection(&queueLock);
+		lstrcpyW(path, queue[queueHead]);
+		queueHead = (queueHead + 1) % QUEUE_LENGTH;
+		LeaveCriticalSection(&queueLock);
+
+		ReleaseSemaphore(slotsSemaphore, 1, NULL);
+
+		if (!path[0])
+			break;
+		PrecompressFile(path);
+	}
+
+	return 0;
+}
+
+static int HasSuffix(const wchar_t *name, int length, const wchar_t *suffix)
+{
+	int suffixLength = lstrlenW(suffix);
+
+	return length > suffixLength && lstrcmpiW(name + length - suffixLength, suffix) == 0;
+}
+
+/* queues the compressible files under path, which has room for MAX_PATH_LEN characters */
+static void WalkDirectory(wchar_t *path)
+{
+	WIN32_FIND_DATAW findData;
+	HANDLE hFind;
+	char nameUtf8[MAX_PATH_LEN];
+	int length = lstrlenW(path), nameLength;
+
+	if (length + 3 > MAX_PATH_LEN)
+		return;
+
+	lstrcpyW(path + length, L"\\*");
+	hFind = FindFirstFileW(path, &findData);
+	if (hFind == INVALID_HANDLE_VALUE)
+	{
+		path[length] = L'\0';
+		return;
+	}
+
+	do
+	{
+		nameLength = lstrlenW(findData.cFileName);
+		if (lstrcmpW(findData.cFileName, L".") == 0 || lstrcmpW(findData.cFileName, L"..") == 0 ||
+			length + 1 + nameLength + 8 > MAX_PATH_LEN)
+			continue;
+
+		path[length] = L'\\';
+		lstrcpyW(path + length + 1, findData.cFileName);
+
+		if (findData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+			WalkDirectory(path);
+		else if (!HasSuffix(findData.cFileName, nameLength, L".gz") && !HasSuffix(findData.cFileName, nameLength, L".br") &&
+				 !HasSuffix(findData.cFileName, nameLength, L".zst") && !HasSuffix(findData.cFileName, nameLength, L".tmp") &&
+				 WideToUtf8(findData.cFileName, nameUtf8, sizeof(nameUtf8)) && Compressible(GetMimeType(nameUtf8)))
+			QueuePath(path);
+	} while (FindNextFileW(hFind, &findData));
+
+	FindClose(hFind);
+	path[length] = L'\0';
+}
+
+/*
+ * Offline mode: writes a .gz sidecar next to every compressible file under
+ * root that lacks an up to date one, on threadCount threads (0 for one per
+ * processor). Brotli and zstd sidecars are served but not made here.
+ */
+int RunPrecompress(const wchar_t *root, int threadCount)
+{
+	HANDLE threads[MAX_WORKERS];
+	wchar_t path[MAX_PATH_LEN];
+	SYSTEM_INFO systemInfo;
+	char buffer[256];
+	int i, started = 0;
+
+	if (threadCount <= 0)
+	{
+		GetSystemInfo(&systemInfo);
+		threadCount = systemInfo.dwNumberOfProcessors ? (int)systemInfo.dwNumberOfProcessors : 1;
+	}
+	if (threadCount > MAX_WORKERS)
+		threadCount = MAX_WORKERS;
+
+	queue = (wchar_t (*)[MAX_PATH_LEN])HeapAlloc(GetProcessHeap(), 0, QUEUE_LENGTH * sizeof(*queue));
+	if (!queue)
+		return 0;
+
+	InitGzip();
+	InitializeCriticalSection(&queueLock);
+	itemsSemaphore = CreateSemaphoreA(NULL, 0, QUEUE_LENGTH, NULL);
+	slotsSemaphore = CreateSemaphoreA(NULL, QUEUE_LENGTH, QUEUE_LENGTH, NULL);
+	if (!itemsSemaphore || !slotsSemaphore)
+		return 0;
+
+	for (i = 0; i < threadCount; i++)
+	{
+		threads[started] = CreateThread(NULL, 0, PrecompressThread, NULL, 0, NULL);
+		if (threads[started])
+			started++;
+	}
+	if (started == 0)
+		return 0;
+
+	wsprintfA(buffer, "Precompressing with %d threads\r\n", started);
+	ConsoleWrite(buffer);
+
+	lstrcpynW(path, root, MAX_PATH_LEN);
+	WalkDirectory(path);
+
+	/* one stop marker per worker, after everything else in the queue */
+	for (i = 0; i < started; i++)
+		QueuePath(L"");
+	WaitForMultipleObjects((DWORD)started, threads, TRUE, INFINITE);
+	for (i = 0; i < started; i++)
+		CloseHandle(threads[i]);
+
+	wsprintfA(buffer, "Compressed %ld files from %ld KB to %ld KB, %ld up to date, %ld skipped, %ld failed\r\n",
+			  compressed, bytesIn, bytesOut, upToDate, skipped, failed);
+	ConsoleWrite(buffer);
+	return failed == 0;
+}
@@ -0,0 +1,9 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+
+#ifndef PRECOMPRESS_H
+#define PRECOMPRESS_H
+
+int Compressible(const char *mimeType);
+int RunPrecompress(const wchar_t *root, int threadCount);
+
+#endif
@@ -0,0 +1,228 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+
+#include "tinyhttp.h"
+#include "util.h"
+#include "metacache.h"
+#include "respcache.h"
+
+#define CACHE_BUCKETS 1024
+
+/*
+ * Serialized responses of small files, looked up by path through a chained
+ * hash table and kept in least recently used order on a list whose head is
+ * the most recent. Entries are reference counted: the cache holds one
+ * reference and every connection sending the entry holds another, so an
+ * evicted entry stays alive until the last send using it has finished.
+ */
+static cachedResponse *buckets[CACHE_BUCKETS];
+static cachedResponse lruList;
+static CRITICAL_SECTION cacheLock;
+static int cacheBudget, cacheUsed, cacheEntries, cacheMaxFile;
+static LONG hits, misses;
+
+static int EntryCost(const cachedResponse *entry)
+{
+	return (int)sizeof(cachedResponse) + lstrlenA(entry->path) + 1 + entry->headLength + entry->bodyLength;
+}
+
+void ReleaseCachedResponse(cachedResponse *entry)
+{
+	if (InterlockedDecrement(&entry->refs) == 0)
+	{
+		HeapFree(GetProcessHeap(), 0, entry->data);
+		if (entry->path)
+			HeapFree(GetProcessHeap(), 0, entry->path);
+		HeapFree(GetProcessHeap(), 0, entry);
+	}
+}
+
+/* takes the entry out of the table and the list, the caller holds cacheLock */
+static void UnlinkEntry(cachedResponse *entry)
+{
+	cachedResponse **link = &buckets[entry->hash % CACHE_BUCKETS];
+
+	while (*link != entry)
+		link = &(*link)->chain;
+	*link = entry->chain;
+
+	entry->prev->next = entry->next;
+	entry->next->prev = entry->prev;
+
+	cacheUsed -= EntryCost(entry);
+	cacheEntries--;
+	ReleaseCachedResponse(entry);
+}
+
+int InitResponseCache(int budget, int maxFileSize)
+{
+	if (budget <= 0 || maxFileSize <= 0)
+		return 1;
+
+	InitializeCriticalSection(&cacheLock);
+	lruList.prev = lruList.next = &lruList;
+	cacheMaxFile = maxFileSize;
+	cacheBudget = budget;
+	return 1;
+}
+
+int ResponseCacheable(DWORDLONG size)
+{
+	return cacheBudget && size <= (DWORDLONG)cacheMaxFile;
+}
+
+cachedResponse *FindCachedResponse(const char *path, const fileInfo *info)
+{
+	DWORD hash = xstrihash(path);
+	cachedResponse *entry;
+
+	EnterCriticalSection(&cacheLock);
+	for (entry = buckets[hash % CACHE_BUCKETS]; entry; entry = entry->chain)
+	{
+		if (entry->hash != hash || lstrcmpiA(entry->path, path) != 0)
+			continue;
+
+		/* the file changed since it was cached */
+		if (entry->size != info->size || CompareFileTime(&entry->lastWrite, &info->lastWrite) != 0)
+		{
+			UnlinkEntry(entry);
+			break;
+		}
+
+		entry->prev->next = entry->next;
+		entry->next->prev = entry->prev;
+		entry->next = lruList.next;
+		entry->prev = &lruList;
+		lruList.next->prev = entry;
+		lruList.next = entry;
+
+		InterlockedIncrement(&entry->refs);
+		LeaveCriticalSection(&cacheLock);
+		InterlockedIncrement(&hits);
+		return entry;
+	}
+	LeaveCriticalSection(&cacheLock);
+
+	InterlockedIncrement(&misses);
+	return NULL;
+}
+
+/* reads the whole file behind head and caches the result, returning a reference for the caller */
+cachedResponse *StoreCachedResponse(const char *path, const fileInfo *info, HANDLE hFile,
+									const char *head, int headLength)
+{
+	cachedResponse *entry, **link;
+	int bodyLength = (int)info->size, total = 0, i;
+	DWORD bytesRead;
+
+	entry = (cachedResponse *)HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY, sizeof(cachedResponse));
+	if (!entry)
+		return NULL;
+
+	entry->path = (char *)HeapAlloc(GetProcessHeap(), 0, lstrlenA(path) + 1);
+	entry->data = (char *)HeapAlloc(GetProcessHeap(), 0, headLength + bodyLength + 1);
+	if (!entry->path || !entry->data)
+		goto fail;
+
+	lstrcpyA(entry->path, path);
+	for (i = 0; i < headLength; i++)
+		entry->data[i] = head[i];
+
+	while (total < bodyLength)
+	{
+		if (!ReadFile(hFile, entry->data + headLength + total, bodyLength - total, &bytesRead, NULL) || bytesRead == 0)
+			goto fail;
+		total += (int)bytesRead;
+	}
+
+	entry->refs = 2;
+	entry->hash = xstrihash(path);
+	entry->size = info->size;
+	entry->lastWrite = info->lastWrite;
+	entry->headLength = headLength;
+	entry->bodyLength = bodyLength;
+
+	/* too big for the budget on its own, serve it once without caching */
+	if (EntryCost(entry) > cacheBudget)
+	{
+		entry->refs = 1;
+		return entry;
+	}
+
+	EnterCriticalSection(&cacheLock);
+
+	/* another request may have cached the same path meanwhile */
+	link = &buckets[entry->hash % CACHE_BUCKETS];
+	while (*link)
+	{
+		if ((*link)->hash == entry->hash && lstrcmpiA((*link)->path, path) == 0)
+		{
+			UnlinkEntry(*link);
+			break;
+		}
+		link = &(*link)->chain;
+	}
+
+	while (cacheEntries && cacheUsed + EntryCost(entry) > cacheBudget)
+		UnlinkEntry(lruList.prev);
+
+	entry->chain = buckets[entry->hash % CACHE_BUCKETS];
+	buckets[entry->hash % CACHE_BUCKETS] = entry;
+	entry->next = lruList.next;
+	entry->prev = &lruList;
+	lruList.next->prev = entry;
+	lruList.next = entry;
+	cacheUsed += EntryCost(entry);
+	cacheEntries++;
+
+	LeaveCriticalSection(&cacheLock);
+	return entry;
+
+fail:
+	if (entry->data)
+		HeapFree(GetProcessHeap(), 0, entry->data);
+	if (entry->path)
+		HeapFree(GetProcessHeap(), 0, entry->path);
+	HeapFree(GetProcessHeap(), 0, entry);
+	return NULL;
+}
+
+/* a response built in memory, owned by the caller and not added to the cache; a NULL body is filled in by the caller */
+cachedResponse *CreateCachedResponse(const char *head, int headLength, const char *body, int bodyLength)
+{
+	cachedResponse *entry;
+	int i;
+
+	entry = (cachedResponse *)HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY, sizeof(cachedResponse));
+	if (!entry)
+		return NULL;
+
+	entry->data = (char *)HeapAlloc(GetProcessHeap(), 0, headLength + bodyLength + 1);
+	if (!entry->data)
+	{
+		HeapFree(GetProcessHeap(), 0, entry);
+		return NULL;
+	}
+
+	for (i = 0; i < headLength; i++)
+		entry->data[i] = head[i];
+	for (i = 0; body && i < bodyLength; i++)
+		entry->data[headLength + i] = body[i];
+
+	entry->refs = 1;
+	entry->headLength = headLength;
+	entry->bodyLength = bodyLength;
+	return entry;
+}
+
+void GetResponseCacheStats(responseCacheStats *stats)
+{
+	if (cacheBudget)
+		EnterCriticalSection(&cacheLock);
+	stats->hits = (DWORD)hits;
+	stats->misses = (DWORD)misses;
+	stats->entries = cacheEntries;
+	stats->used = cacheUsed;
+	stats->budget = cacheBudget;
+	if (cacheBudget)
+		LeaveCriticalSection(&cacheLock);
+}
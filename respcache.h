@@ -0,0 +1,36 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+
+#ifndef RESPCACHE_H
+#define RESPCACHE_H
+
+/* a whole 200 response: headers up to the Connection line, then the body */
+typedef struct cachedResponse {
+	struct cachedResponse *prev, *next, *chain;
+	LONG refs;
+	DWORD hash;
+	char *path;
+	DWORDLONG size;
+	FILETIME lastWrite;
+	char *data;
+	int headLength;
+	int bodyLength;
+} cachedResponse;
+
+typedef struct {
+	DWORD hits;
+	DWORD misses;
+	int entries;
+	int used;
+	int budget;
+} responseCacheStats;
+
+int InitResponseCache(int budget, int maxFileSize);
+int ResponseCacheable(DWORDLONG size);
+cachedResponse *FindCachedResponse(const char *path, const fileInfo *info);
+cachedResponse *StoreCachedResponse(const char *path, const fileInfo *info, HANDLE hFile,
+									const char *head, int headLength);
+cachedResponse *CreateCachedResponse(const char *head, int headLength, const char *body, int bodyLength);
+void ReleaseCachedResponse(cachedResponse *entry);
+void GetResponseCacheStats(responseCacheStats *stats);
+
+#endif
@@ -0,0 +1,639 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+
+#include "tinyhttp.h"
+#include "util.h"
+#include "pool.h"
+#include "metacache.h"
+#include "respcache.h"
+#include "listcache.h"
+#include "log.h"
+#include "buffers.h"
+#include "mapcache.h"
+#include "stats.h"
+
+static const char *sendPathNames[SEND_PATHS] = { "buffered", "transmitfile", "cached", "mapped" };
+
+/*
+ * Every thread counts into its own block, so serving a request never
+ * touches a shared cache line. Readers add the blocks up. The sequence
+ * number is odd while the owner is updating, a reader that sees it odd
+ * or changed reads the block again.
+ *
+ * Blocks are never freed or folded: a thread that exits leaves its counts
+ * in place and its block on a free list, and the next thread keeps adding
+ * to it. A thread per connection then costs neither an allocation nor the
+ * readers' lock.
+ */
+typedef struct threadStats {
+	struct threadStats *next;
+	struct threadStats *nextFree;
+	volatile LONG sequence;
+	serverStats counts;
+} threadStats;
+
+static CRITICAL_SECTION statsLock, freeLock;
+static DWORD tlsIndex = TLS_OUT_OF_INDEXES;
+static threadStats *threads, *freeStats;
+static LONG activeConnections, acceptedConnections;
+
+/* the counter frequency shifted right by clockShift until it fits in 32 bits */
+static DWORD clockFrequency;
+static int clockShift;
+
+void InitStats(void)
+{
+	LARGE_INTEGER frequency;
+
+	InitializeCriticalSection(&statsLock);
+	InitializeCriticalSection(&freeLock);
+	tlsIndex = TlsAlloc();
+
+	/*
+	 * xdiv64 divides by 32 bits, very fast counters are slowed down to fit.
+	 * The words are shifted separately, a variable 64 bit shift would need
+	 * a compiler helper on x86.
+	 */
+	if (QueryPerformanceFrequency(&frequency) && frequency.QuadPart > 0)
+	{
+		DWORD high = (DWORD)frequency.u.HighPart, low = frequency.u.LowPart;
+
+		while (high)
+		{
+			low = (low >> 1) | (high << 31);
+			high >>= 1;
+			clockShift++;
+		}
+		clockFrequency = low;
+	}
+}
+
+/* a timestamp for the latency counters, in units only they need to know */
+DWORDLONG StatsClock(void)
+{
+	LARGE_INTEGER now;
+	DWORD high, low;
+
+	if (!clockFrequency || !QueryPerformanceCounter(&now))
+		return GetTickCount();
+
+	/* clockShift is below 32, the frequency's high word was a positive LONG */
+	high = (DWORD)now.u.HighPart;
+	low = now.u.LowPart;
+	if (clockShift)
+	{
+		low = (low >> clockShift) | (high << (32 - clockShift));
+		high >>= clockShift;
+	}
+	return ((DWORDLONG)high << 32) | low;
+}
+
+static DWORD ToMicroseconds(DWORDLONG ticks)
+{
+	DWORD frequency = clockFrequency ? clockFrequency : 1000;
+	DWORDLONG seconds = xdiv64(ticks, frequency);
+	DWORD remainder;
+
+	/* anything longer than an hour counts as an hour, which keeps the result in 32 bits */
+	if (seconds >= 3600)
+		return 3600000000UL;
+
+	/* below the frequency, so the low words alone give it */
+	remainder = (DWORD)ticks - (DWORD)seconds * frequency;
+	return (DWORD)seconds * 1000000 + (DWORD)xdiv64(UInt32x32To64(remainder, 1000000), frequency);
+}
+
+/*
+ * HDR style buckets: values below 4 have their own, above that each power
+ * of two is split into four, so a bucket is never wider than a quarter of
+ * its values. Bucket i holds value - 1, which makes every power of two the
+ * upper end of a bucket.
+ */
+static int BucketIndex(DWORD value)
+{
+	int shift = 0;
+
+	if (value < 4)
+		return (int)value;
+
+	while (value >> shift > 7)
+		shift++;
+
+	return (shift + 1) * 4 + (int)((value >> shift) & 3);
+}
+
+/* the largest value counted in bucket i, the last one ends at 2^32 which is cut to fit */
+static DWORD BucketLimit(int i)
+{
+	int shift = i / 4 - 1;
+
+	if (i < 4)
+		return i + 1;
+	if (shift > 29 || (shift == 29 && i % 4 == 3))
+		return 0xFFFFFFFF;
+
+	return (DWORD)(5 + i % 4) << shift;
+}
+
+static void AddLatency(latencyHistogram *histogram, DWORD micros)
+{
+	histogram->counts[BucketIndex(micros ? micros - 1 : 0)]++;
+	histogram->count++;
+	histogram->sum += micros;
+	if (micros > histogram->max)
+		histogram->max = micros;
+}
+
+static void AddHistogram(latencyHistogram *to, const latencyHistogram *from)
+{
+	int i;
+
+	for (i = 0; i < LATENCY_BUCKETS; i++)
+		to->counts[i] += from->counts[i];
+	to->count += from->count;
+	to->sum += from->sum;
+	if (from->max > to->max)
+		to->max = from->max;
+}
+
+static void AddStats(serverStats *to, const serverStats *from)
+{
+	int i;
+
+	to->requests += from->requests;
+	to->aborted += from->aborted;
+	for (i = 0; i < STATUS_CODES; i++)
+		to->status[i] += from->status[i];
+	to->bytesSent += from->bytesSent;
+	for (i = 0; i < SEND_PATHS; i++)
+	{
+		to->sendCount[i] += from->sendCount[i];
+		to->sendBytes[i] += from->sendBytes[i];
+	}
+	AddHistogram(&to->firstByte, &from->firstByte);
+	AddHistogram(&to->total, &from->total);
+}
+
+static void ZeroStats(serverStats *stats)
+{
+	char *p = (char *)stats;
+	int i;
+
+	for (i = 0; i < (int)sizeof(serverStats); i++)
+		p[i] = 0;
+}
+
+/* the calling thread's block, created on first use, or NULL if there is no memory for it */
+static threadStats *ThreadStats(void)
+{
+	threadStats *stats;
+
+	if (tlsIndex == TLS_OUT_OF_INDEXES)
+		return NULL;
+
+	stats = (threadStats *)TlsGetValue(tlsIndex);
+	if (stats)
+		return stats;
+
+	EnterCriticalSection(&freeLock);
+	stats = freeStats;
+	if (stats)
+		freeStats = stats->nextFree;
+	LeaveCriticalSection(&freeLock);
+
+	if (!stats)
+	{
+		stats = (threadStats *)HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY, sizeof(threadStats));
+		if (!stats)
+			return NULL;
+
+		EnterCriticalSection(&statsLock);
+		stats->next = threads;
+		threads = stats;
+		LeaveCriticalSection(&statsLock);
+	}
+
+	TlsSetValue(tlsIndex, stats);
+	return stats;
+}
+
+void CountSend(int path, DWORDLONG bytes)
+{
+	threadStats *stats = ThreadStats();
+
+	if (!stats)
+		return;
+
+	InterlockedIncrement(&stats->sequence);
+	stats->counts.sendCount[path]++;
+	stats->counts.sendBytes[path] += bytes;
+	InterlockedIncrement(&stats->sequence);
+}
+
+/* +1 when a connection is accepted, -1 when it is closed */
+void CountConnection(int delta)
+{
+	InterlockedExchangeAdd(&activeConnections, delta);
+	if (delta > 0)
+		InterlockedIncrement(&acceptedConnections);
+}
+
+/* a response that went out completely, timed from when its request was complete */
+void CountResponse(int status, DWORDLONG bytes, DWORDLONG start, DWORDLONG firstByte)
+{
+	threadStats *stats = ThreadStats();
+	DWORDLONG now = StatsClock();
+	DWORD firstMicros, totalMicros;
+
+	if (!stats)
+		return;
+
+	if (!firstByte)
+		firstByte = now;
+	firstMicros = ToMicroseconds(firstByte - start);
+	totalMicros = ToMicroseconds(now - start);
+
+	InterlockedIncrement(&stats->sequence);
+	stats->counts.requests++;
+	if (status >= STATUS_FIRST && status < STATUS_FIRST + STATUS_CODES)
+		stats->counts.status[status - STATUS_FIRST]++;
+	stats->counts.bytesSent += bytes;
+	AddLatency(&stats->counts.firstByte, firstMicros);
+	AddLatency(&stats->counts.total, totalMicros);
+	InterlockedIncrement(&stats->sequence);
+}
+
+/* a response that could not be sent completely */
+void CountAborted(void)
+{
+	threadStats *stats = ThreadStats();
+
+	if (!stats)
+		return;
+
+	InterlockedIncrement(&stats->sequence);
+	stats->counts.aborted++;
+	InterlockedIncrement(&stats->sequence);
+}
+
+/* hands the block of a thread about to exit to the next one, its counts stay in it */
+void StatsThreadDone(void)
+{
+	threadStats *stats;
+
+	if (tlsIndex == TLS_OUT_OF_INDEXES)
+		return;
+
+	stats = (threadStats *)TlsGetValue(tlsIndex);
+	if (!stats)
+		return;
+
+	TlsSetValue(tlsIndex, NULL);
+
+	EnterCriticalSection(&freeLock);
+	stats->nextFree = freeStats;
+	freeStats = stats;
+	LeaveCriticalSection(&freeLock);
+}
+
+void GetServerStats(serverStats *stats)
+{
+	serverStats snapshot;
+	threadStats *thread;
+
+	ZeroStats(stats);
+
+	EnterCriticalSection(&statsLock);
+	for (thread = threads; thread; thread = thread->next)
+	{
+		LONG sequence;
+
+		do
+		{
+			while ((sequence = InterlockedCompareExchange(&thread->sequence, 0, 0)) & 1)
+				Sleep(0);
+
+			ZeroStats(&snapshot);
+			AddStats(&snapshot, &thread->counts);
+		} while (InterlockedCompareExchange(&thread->sequence, 0, 0) != sequence);
+
+		AddStats(stats, &snapshot);
+	}
+	LeaveCriticalSection(&statsLock);
+
+	stats->activeConnections = InterlockedCompareExchange(&activeConnections, 0, 0);
+	stats->acceptedConnections = InterlockedCompareExchange(&acceptedConnections, 0, 0);
+}
+
+/* the upper end of the bucket holding the given share of samples, in thousandths */
+static DWORD Percentile(const latencyHistogram *histogram, int thousandths)
+{
+	DWORD rank, seen = 0, limit;
+	int i;
+
+	if (!histogram->count)
+		return 0;
+
+	/* count * thousandths / 1000 rounded up, in two parts so nothing needs 64 bits */
+	rank = histogram->count / 1000 * thousandths + (histogram->count % 1000 * thousandths + 999) / 1000;
+	for (i = 0; i < LATENCY_BUCKETS - 1; i++)
+	{
+		seen += histogram->counts[i];
+		if (seen >= rank)
+			break;
+	}
+
+	limit = BucketLimit(i);
+	return limit < histogram->max ? limit : histogram->max;
+}
+
+typedef struct {
+	char *data;
+	int length;
+	int size;
+} statsText;
+
+/* appends as much as fits, the text stays terminated */
+static void AddText(statsText *out, const char *text)
+{
+	while (*text && out->length < out->size - 1)
+		out->data[out->length++] = *text++;
+	out->data[out->length] = '\0';
+}
+
+static void AddPrometheusHistogram(statsText *out, const char *name, const char *help,
+								   const latencyHistogram *histogram)
+{
+	char line[512], number[24];
+	DWORD cumulative = 0;
+	int i = 0, power;
+
+	wsprintfA(line, "# HELP %s %s\n# TYPE %s histogram\n", name, help, name);
+	AddText(out, line);
+
+	/* one boundary per power of two keeps the output short, the buckets line up with them */
+	for (power = 0; power < 32; power++)
+	{
+		int end = BucketIndex((DWORD)1 << power);
+
+		while (i < end)
+			cumulative += histogram->counts[i++];
+		wsprintfA(line, "%s_bucket{le=\"%lu\"} %lu\n", name, (DWORD)1 << power, cumulative);
+		AddText(out, line);
+	}
+
+	xu64toa(histogram->sum, number);
+	wsprintfA(line, "%s_bucket{le=\"+Inf\"} %lu\n%s_sum %s\n%s_count %lu\n",
+			  name, histogram->count, name, number, name, histogram->count);
+	AddText(out, line);
+}
+
+static void FormatPrometheus(statsText *out, const serverStats *stats)
+{
+	char line[512], number[24];
+	int i;
+
+	wsprintfA(line, "# HELP tinyhttp_connections_active Connections currently open.\n"
+			  "# TYPE tinyhttp_connections_active gauge\n"
+			  "tinyhttp_connections_active %ld\n"
+			  "# HELP tinyhttp_connections_total Connections accepted.\n"
+			  "# TYPE tinyhttp_connections_total counter\n"
+			  "tinyhttp_connections_total %ld\n",
+			  stats->activeConnections, stats->acceptedConnections);
+	AddText(out, line);
+
+	AddText(out, "# HELP tinyhttp_responses_total Responses sent completely, by status code.\n"
+			"# TYPE tinyhttp_responses_total counter\n");
+	for (i = 0; i < STATUS_CODES; i++)
+		if (stats->status[i])
+		{
+			wsprintfA(line, "tinyhttp_responses_total{code=\"%d\"} %lu\n", STATUS_FIRST + i, stats->status[i]);
+			AddText(out, line);
+		}
+
+	xu64toa(stats->bytesSent, number);
+	wsprintfA(line, "# HELP tinyhttp_responses_aborted_total Responses cut short by a failed send.\n"
+			  "# TYPE tinyhttp_responses_aborted_total counter\n"
+			  "tinyhttp_responses_aborted_total %lu\n"
+			  "# HELP tinyhttp_sent_bytes_total Bytes of complete responses, headers included.\n"
+			  "# TYPE tinyhttp_sent_bytes_total counter\n"
+			  "tinyhttp_sent_bytes_total %s\n",
+			  stats->aborted, number);
+	AddText(out, line);
+
+	AddText(out, "# HELP tinyhttp_send_path_responses_total Response bodies by the way they were sent.\n"
+			"# TYPE tinyhttp_send_path_responses_total counter\n");
+	for (i = 0; i < SEND_PATHS; i++)
+	{
+		wsprintfA(line, "tinyhttp_send_path_responses_total{path=\"%s\"} %lu\n", sendPathNames[i], stats->sendCount[i]);
+		AddText(out, line);
+	}
+
+	AddText(out, "# HELP tinyhttp_send_path_bytes_total Body bytes by the way they were sent.\n"
+			"# TYPE tinyhttp_send_path_bytes_total counter\n");
+	for (i = 0; i < SEND_PATHS; i++)
+	{
+		xu64toa(stats->sendBytes[i], number);
+		wsprintfA(line, "tinyhttp_send_path_bytes_total{path=\"%s\"} %s\n", sendPathNames[i], number);
+		AddText(out, line);
+	}
+
+	AddPrometheusHistogram(out, "tinyhttp_first_byte_microseconds",
+						   "Time from a complete request to the first response bytes being sent.", &stats->firstByte);
+	AddPrometheusHistogram(out, "tinyhttp_response_microseconds",
+						   "Time from a complete request to the last response bytes being sent.", &stats->total);
+}
+
+static void AddJsonHistogram(statsText *out, const char *name, const latencyHistogram *histogram, int last)
+{
+	char line[256];
+
+	wsprintfA(line, "\"%s\":{\"count\":%lu,\"mean\":%lu,\"p50\":%lu,\"p90\":%lu,\"p99\":%lu,\"p999\":%lu,\"max\":%lu}%s",
+			  name, histogram->count,
+			  histogram->count ? (DWORD)xdiv64(histogram->sum, histogram->count) : 0,
+			  Percentile(histogram, 500), Percentile(histogram, 900),
+			  Percentile(histogram, 990), Percentile(histogram, 999),
+			  histogram->max, last ? "" : ",");
+	AddText(out, line);
+}
+
+static void FormatJson(statsText *out, const serverStats *stats)
+{
+	char line[512], number[24];
+	int i, first = 1;
+
+	wsprintfA(line, "{\"connections\":{\"active\":%ld,\"accepted\":%ld},"
+			  "\"responses\":{\"total\":%lu,\"aborted\":%lu,\"status\":{",
+			  stats->activeConnections, stats->acceptedConnections, stats->requests, stats->aborted);
+	AddText(out, line);
+
+	for (i = 0; i < STATUS_CODES; i++)
+		if (stats->status[i])
+		{
+			wsprintfA(line, "%s\"%d\":%lu", first ? "" : ",", STATUS_FIRST + i, stats->status[i]);
+			AddText(out, line);
+			first = 0;
+		}
+
+	xu64toa(stats->bytesSent, number);
+	wsprintfA(line, "}},\"bytes_sent\":%s,\"send_paths\":{", number);
+	AddText(out, line);
+
+	for (i = 0; i < SEND_PATHS; i++)
+	{
+		xu64toa(stats->sendBytes[i], number);
+		wsprintfA(line, "\"%s\":{\"responses\":%lu,\"bytes\":%s}%s",
+				  sendPathNames[i], stats->sendCount[i], number, i + 1 < SEND_PATHS ? "," : "");
+		AddText(out, line);
+	}
+
+	AddText(out, "},\"latency_us\":{");
+	AddJsonHistogram(out, "first_byte", &stats->firstByte, 0);
+	AddJsonHistogram(out, "total", &stats->total, 1);
+	AddText(out, "}}\n");
+}
+
+/* the current counters as Prometheus text or JSON, returns the length */
+int FormatStats(char *buffer, int size, int json)
+{
+	serverStats stats;
+	statsText out;
+
+	out.data = buffer;
+	out.length = 0;
+	out.size = size;
+	buffer[0] = '\0';
+
+	GetServerStats(&stats);
+	if (json)
+		FormatJson(&out, &stats);
+	else
+		FormatPrometheus(&out, &stats);
+
+	return out.length;
+}
+
+static DWORDLONG GetProcessCpuTime(void)
+{
+	FILETIME creationTime, exitTime, kernelTime, userTime;
+
+	if (!GetProcessTimes(GetCurrentProcess(), &creationTime, &exitTime, &kernelTime, &userTime))
+		return 0;
+
+	return (((DWORDLONG)kernelTime.dwHighDateTime << 32) | kernelTime.dwLowDateTime) +
+		   (((DWORDLONG)userTime.dwHighDateTime << 32) | userTime.dwLowDateTime);
+}
+
+static DWORD WINAPI StatsThread(LPVOID param)
+{
+	DWORD interval = (DWORD)(DWORD_PTR)param;
+	DWORDLONG lastCpu = GetProcessCpuTime(), lastBytes = 0;
+	char buffer[256];
+
+	while (1)
+	{
+		DWORDLONG cpu, bytes = 0, megabytes;
+		serverStats stats;
+		poolStats pool;
+		metaCacheStats cache;
+		responseCacheStats responses;
+		listingCacheStats listings;
+		bufferStats buffers;
+		mapCacheStats mappings;
+		int i;
+
+		Sleep(interval);
+
+		GetServerStats(&stats);
+		for (i = 0; i < SEND_PATHS; i++)
+		{
+			megabytes = stats.sendBytes[i] >> 20;
+			bytes += stats.sendBytes[i];
+			wsprintfA(buffer, "Sent %s: %lu responses, %lu MB\r\n",
+					  sendPathNames[i], stats.sendCount[i], (DWORD)megabytes);
+			LogWrite(LOG_INFO, buffer);
+		}
+
+		if (stats.requests)
+		{
+			wsprintfA(buffer, "Responses: %lu, %ld connections open, first byte p50 %lu us p99 %lu us, total p50 %lu us p99 %lu us\r\n",
+					  stats.requests, stats.activeConnections,
+					  Percentile(&stats.firstByte, 500), Percentile(&stats.firstByte, 990),
+					  Percentile(&stats.total, 500), Percentile(&stats.total, 990));
+			LogWrite(LOG_INFO, buffer);
+		}
+
+		/* CPU time is in 100 ns units, bytes >> 20 gives megabytes */
+		cpu = GetProcessCpuTime();
+		megabytes = (bytes - lastBytes) >> 20;
+		if (megabytes)
+		{
+			wsprintfA(buffer, "CPU: %lu ms per GB served\r\n",
+					  (DWORD)xdiv64(UInt32x32To64((DWORD)xdiv64(cpu - lastCpu, 10000), 1024), (DWORD)megabytes));
+			LogWrite(LOG_INFO, buffer);
+		}
+		lastCpu = cpu;
+		lastBytes = bytes;
+
+		GetPoolStats(&pool);
+		if (pool.threads)
+		{
+			wsprintfA(buffer, "Pool: %d threads, queue depth %d (peak %d), %lu served, wait avg %lu ms, max %lu ms\r\n",
+					  pool.threads, pool.depth, pool.peakDepth, pool.served, pool.averageWait, pool.maxWait);
+			LogWrite(LOG_INFO, buffer);
+		}
+
+		GetMetaCacheStats(&cache);
+		if (cache.hits || cache.misses)
+		{
+			wsprintfA(buffer, "Metadata cache: %lu hits, %lu misses, %d entries\r\n",
+					  cache.hits, cache.misses, cache.entries);
+			LogWrite(LOG_INFO, buffer);
+		}
+
+		GetResponseCacheStats(&responses);
+		if (responses.budget)
+		{
+			wsprintfA(buffer, "Response cache: %lu hits, %lu misses, %d entries, %d of %d KB\r\n",
+					  responses.hits, responses.misses, responses.entries, responses.used >> 10, responses.budget >> 10);
+			LogWrite(LOG_INFO, buffer);
+		}
+
+		GetListingCacheStats(&listings);
+		if (listings.hits || listings.misses)
+		{
+			wsprintfA(buffer, "Listing cache: %lu hits, %lu misses, %lu invalidated, %d entries\r\n",
+					  listings.hits, listings.misses, listings.invalidations, listings.entries);
+			LogWrite(LOG_INFO, buffer);
+		}
+
+		GetMapCacheStats(&mappings);
+		if (mappings.opened)
+		{
+			wsprintfA(buffer, "Mapped files: %d open, %d windows mapped, %lu mapped in all, %lu shared\r\n",
+					  mappings.files, mappings.views, mappings.opened, mappings.shared);
+			LogWrite(LOG_INFO, buffer);
+		}
+
+		GetBufferStats(&buffers);
+		wsprintfA(buffer, "Connection buffers: %d in use, %d free, %lu reused, %lu allocated\r\n",
+				  buffers.inUse, buffers.free, buffers.reused, buffers.created);
+		LogWrite(LOG_INFO, buffer);
+	}
+
+	return 0;
+}
+
+int StartStatsReporter(int seconds)
+{
+	HANDLE threadHandle;
+
+	if (seconds <= 0)
+		return 1;
+
+	threadHandle = CreateThread(NULL, 0, StatsThread, (LPVOID)(DWORD_PTR)(seconds * 1000), 0, NULL);
+	if (threadHandle == NULL)
+		return 0;
+
+	CloseHandle(threadHandle);
+	return 1;
+}
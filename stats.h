@@ -0,0 +1,54 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+
+#ifndef STATS_H
+#define STATS_H
+
+#define SEND_BUFFERED 0
+#define SEND_TRANSMITFILE 1
+#define SEND_CACHED 2
+#define SEND_MAPPED 3
+#define SEND_PATHS 4
+
+/* status codes 100 to 599 are counted one by one */
+#define STATUS_FIRST 100
+#define STATUS_CODES 500
+
+/* four buckets per power of two, enough for 2^32 microseconds */
+#define LATENCY_BUCKETS 124
+
+/* large enough for either format of FormatStats */
+#define STATS_TEXT_SIZE 16384
+
+/* latencies in microseconds */
+typedef struct {
+	DWORD counts[LATENCY_BUCKETS];
+	DWORD count;
+	DWORD max;
+	DWORDLONG sum;
+} latencyHistogram;
+
+typedef struct {
+	LONG activeConnections;
+	LONG acceptedConnections;
+	DWORD requests;
+	DWORD aborted;
+	DWORD status[STATUS_CODES];
+	DWORDLONG bytesSent;
+	DWORD sendCount[SEND_PATHS];
+	DWORDLONG sendBytes[SEND_PATHS];
+	latencyHistogram firstByte;
+	latencyHistogram total;
+} serverStats;
+
+void InitStats(void);
+DWORDLONG StatsClock(void);
+void CountSend(int path, DWORDLONG bytes);
+void CountConnection(int delta);
+void CountResponse(int status, DWORDLONG bytes, DWORDLONG start, DWORDLONG firstByte);
+void CountAborted(void);
+void StatsThreadDone(void);
+void GetServerStats(serverStats *stats);
+int FormatStats(char *buffer, int size, int json);
+int StartStatsReporter(int seconds);
+
+#endif
@@ -1,18 +1,19 @@
 /* SPDX-License-Identifier: GPL-2.0-or-later */
 
-#define WIN32_LEAN_AND_MEAN
-#if _MSC_VER < 1100
-#include <winsock.h>
-#include <windows.h>
-#else
-#include <winsock2.h>
-#include <windows.h>
-#include <ws2tcpip.h>
-#endif
-
+#include "tinyhttp.h"
 #include "unicode.h"
 #include "util.h"
 #include "mime.h"
+#include "iocp.h"
+#include "pool.h"
+#include "stats.h"
+#include "metacache.h"
+#include "respcache.h"
+#include "listcache.h"
+#include "log.h"
+#include "buffers.h"
+#include "mapcache.h"
+#include "precompress.h"
 
 #if _MSC_VER > 1000
 #include "iphlp.h"
@@ -26,25 +27,30 @@
 #define __attribute__(x)
 #endif
 
-#ifndef SD_SEND
-#define SD_SEND 1
-#endif
-
 #ifndef INVALID_FILE_ATTRIBUTES
 #define INVALID_FILE_ATTRIBUTES ((DWORD)-1)
 #endif
 
-#define BUFFER_SIZE 8192
-#define MAX_PATH_LEN 1024
+#define ENGINE_THREADS 0
+#define ENGINE_IOCP 1
+#define ENGINE_POOL 2
+
+static int zeroCopyEnabled;
+static DWORD zeroCopyMinimum;
+static int keepAliveTimeout;
+static int keepAliveMax;
+static wchar_t logPath[MAX_PATH];
+static int statsEndpoint;
+static int asyncReads;
+static int noDelay;
+static int sendBufferSize;
+static int precompressed;
+static SOCKET serverSocket;
+static int engine;
 
-typedef struct {
-	char *requestBuffer;
-	char *fileBuffer;
-	char *baseAllocation;
-} threadBuffers;
+#define STATS_PATH "/__tinyhttp/stats"
 
-const char HTTP_HEADER[] = "HTTP/1.1 200 OK\r\nContent-Type: text/html; charset=utf-8\r\nServer: TinyHTTP/1.0\r\nConnection: close\r\n\r\n";
-const char HTTP_404[] = "HTTP/1.1 404 Not Found\r\nContent-Type: text/plain\r\nServer: TinyHTTP/1.0\r\nConnection: close\r\n\r\n404 Not Found\n";
+const char HTTP_500[] = "HTTP/1.1 500 Internal Server Error\r\nContent-Type: text/plain\r\nServer: TinyHTTP/1.0\r\nConnection: close\r\n\r\n500 Internal Server Error\n";
 
 const char HTML_START[] = 
 "<!DOCTYPE html>\n"
@@ -65,366 +71,1688 @@ const char HTML_START[] =
 "	<h1>Directory Listing</h1>\n"
 "	<hr>\n";
 
-const char HTML_END[] = 
-"	<hr>\n"
-"	<p><em>Tiny HTTP Server</em></p>\n"
-"</body>\n"
-"</html>\n";
+const char HTML_END[] = 
+"	<hr>\n"
+"	<p><em>Tiny HTTP Server</em></p>\n"
+"</body>\n"
+"</html>\n";
+
+int DirectoryExists(const wchar_t *path)
+{
+	DWORD attrib = GetFileAttributesW(path);
+	if (attrib == INVALID_FILE_ATTRIBUTES)
+		return 0;
+
+	return (attrib & FILE_ATTRIBUTE_DIRECTORY);
+}
+
+/* returns the value of the first header called name, or NULL */
+static const char *FindHeader(const connection *conn, const char *name, int *length)
+{
+	const httpView *value = HttpFindHeader(&conn->request, name);
+
+	if (!value)
+		return NULL;
+
+	*length = value->length;
+	return value->data;
+}
+
+/* looks for token in a comma separated header value such as Connection */
+static int HeaderHasToken(const char *value, int length, const char *token)
+{
+	int tokenLength = lstrlenA(token);
+	const char *end = value + length;
+
+	while (value < end)
+	{
+		const char *item;
+
+		while (value < end && (*value == ' ' || *value == '\t' || *value == ','))
+			value++;
+
+		item = value;
+		while (value < end && *value != ',')
+			value++;
+
+		while (value > item && (value[-1] == ' ' || value[-1] == '\t'))
+			value--;
+
+		if (value - item == tokenLength && xstrnicmp(item, token, tokenLength) == 0)
+			return 1;
+
+		while (value < end && *value != ',')
+			value++;
+	}
+
+	return 0;
+}
+
+/* true unless the item's parameters carry q=0 */
+static int QualityNonZero(const char *params, const char *end)
+{
+	while (params < end)
+	{
+		while (params < end && (*params == ' ' || *params == '\t' || *params == ';'))
+			params++;
+
+		if (end - params >= 2 && (params[0] == 'q' || params[0] == 'Q') && params[1] == '=')
+		{
+			for (params += 2; params < end && (*params == '0' || *params == '.'); params++)
+				;
+			return params < end && *params >= '1' && *params <= '9';
+		}
+
+		while (params < end && *params != ';')
+			params++;
+	}
+
+	return 1;
+}
+
+/* whether an Accept-Encoding value allows coding, by name or through * */
+static int AcceptsEncoding(const char *value, int length, const char *coding)
+{
+	int codingLength = lstrlenA(coding), wildcard = -1;
+	const char *end = value + length;
+
+	while (value < end)
+	{
+		const char *item, *itemEnd, *nameEnd;
+
+		while (value < end && (*value == ' ' || *value == '\t' || *value == ','))
+			value++;
+
+		item = value;
+		while (value < end && *value != ',')
+			value++;
+		itemEnd = value;
+
+		for (nameEnd = item; nameEnd < itemEnd && *nameEnd != ';' && *nameEnd != ' ' && *nameEnd != '\t'; nameEnd++)
+			;
+
+		if (nameEnd - item == codingLength && xstrnicmp(item, coding, codingLength) == 0)
+			return QualityNonZero(nameEnd, itemEnd);
+		if (nameEnd - item == 1 && *item == '*')
+			wildcard = QualityNonZero(nameEnd, itemEnd);
+	}
+
+	return wildcard > 0;
+}
+
+void InitConnection(connection *conn, SOCKET clientSocket, char *buffers)
+{
+	conn->socket = clientSocket;
+	conn->requestBuffer = buffers;
+	conn->fileBuffer = buffers ? buffers + BUFFER_SIZE : NULL;
+	conn->requestLength = 0;
+	conn->requestSize = 0;
+	conn->requestCount = 0;
+	conn->keepAlive = 0;
+	HttpInitRequest(&conn->request);
+	conn->requestStart = 0;
+	conn->firstByte = 0;
+	conn->segmentCount = 0;
+	conn->segmentIndex = 0;
+	conn->segmentSent = 0;
+	conn->bodyBlocks = 0;
+	conn->bodyLength = 0;
+	conn->hFile = INVALID_HANDLE_VALUE;
+	conn->fileLength = 0;
+	conn->fileSent = 0;
+	conn->asyncFile = 0;
+	conn->mapped = NULL;
+	conn->mapWindow = NO_WINDOW;
+	conn->mapView = NULL;
+	conn->sendPath = SEND_BUFFERED;
+	conn->cached = NULL;
+	conn->scratch = NULL;
+}
+
+void ResetResponse(connection *conn)
+{
+	int i;
+
+	for (i = 0; i < conn->bodyBlocks; i++)
+		HeapFree(GetProcessHeap(), 0, conn->body[i].data);
+	if (conn->hFile != INVALID_HANDLE_VALUE)
+	{
+		CountSend(conn->sendPath, conn->fileSent);
+		CloseHandle(conn->hFile);
+	}
+	if (conn->cached)
+	{
+		CountSend(SEND_CACHED, conn->cached->bodyLength);
+		ReleaseCachedResponse(conn->cached);
+	}
+	if (conn->mapped)
+	{
+		CountSend(SEND_MAPPED, conn->fileSent);
+		if (conn->mapWindow != NO_WINDOW)
+			ReleaseWindow(conn->mapped, conn->mapWindow);
+		ReleaseMappedFile(conn->mapped);
+	}
+
+	conn->segmentCount = 0;
+	conn->segmentIndex = 0;
+	conn->segmentSent = 0;
+	conn->bodyBlocks = 0;
+	conn->bodyLength = 0;
+	conn->hFile = INVALID_HANDLE_VALUE;
+	conn->fileLength = 0;
+	conn->fileSent = 0;
+	conn->asyncFile = 0;
+	conn->mapped = NULL;
+	conn->mapWindow = NO_WINDOW;
+	conn->mapView = NULL;
+	conn->sendPath = SEND_BUFFERED;
+	conn->cached = NULL;
+}
+
+/* the mapped bytes at a file position up to the end of their window, NULL if they could not be mapped */
+const char *MappedBytes(connection *conn, DWORDLONG position, DWORD *length)
+{
+	DWORD window = (DWORD)(position >> MAP_WINDOW_SHIFT);
+	DWORD start = (DWORD)position & (MAP_WINDOW - 1);
+	DWORDLONG remaining = conn->mapped->size - position;
+
+	if (window != conn->mapWindow)
+	{
+		if (conn->mapWindow != NO_WINDOW)
+			ReleaseWindow(conn->mapped, conn->mapWindow);
+		conn->mapWindow = NO_WINDOW;
+
+		conn->mapView = AcquireWindow(conn->mapped, window);
+		if (!conn->mapView)
+			return NULL;
+		conn->mapWindow = window;
+	}
+
+	*length = remaining < MAP_WINDOW - start ? (DWORD)remaining : MAP_WINDOW - start;
+	return conn->mapView + start;
+}
+
+/* counts the response once it went out or failed, then frees it */
+void FinishResponse(connection *conn, int sent)
+{
+	if (conn->segmentCount > 0)
+	{
+		if (sent)
+		{
+			const char *head = conn->segments[0].data;
+			DWORDLONG length = 0;
+			int i, status = 0;
+
+			/* every response starts with its own head, "HTTP/1.1 200 OK" */
+			for (i = 9; i < 12 && head[i] >= '0' && head[i] <= '9'; i++)
+				status = status * 10 + head[i] - '0';
+			for (i = 0; i < conn->segmentCount; i++)
+				length += conn->segments[i].length;
+
+			CountResponse(status, length, conn->requestStart, conn->firstByte);
+		}
+		else
+			CountAborted();
+	}
+
+	ResetResponse(conn);
+}
+
+/* data == NULL adds a range of the connection's file */
+static void AddSegment(connection *conn, const char *data, DWORDLONG offset, DWORDLONG length)
+{
+	segment *seg;
+
+	if (length == 0 || conn->segmentCount >= MAX_SEGMENTS)
+		return;
+
+	seg = &conn->segments[conn->segmentCount++];
+	seg->data = data;
+	seg->offset = offset;
+	seg->length = length;
+}
+
+static void SetResponse(connection *conn, const char *response, int length)
+{
+	conn->segmentCount = 0;
+	AddSegment(conn, response, 0, length);
+}
+
+/* marks bytes as sent, moving on to the next segment where one is finished */
+void AdvanceResponse(connection *conn, DWORDLONG bytes)
+{
+	if (bytes && !conn->firstByte)
+		conn->firstByte = StatsClock();
+
+	while (bytes > 0 && conn->segmentIndex < conn->segmentCount)
+	{
+		DWORDLONG remaining = conn->segments[conn->segmentIndex].length - conn->segmentSent;
+
+		if (bytes < remaining)
+		{
+			conn->segmentSent += bytes;
+			return;
+		}
+
+		bytes -= remaining;
+		conn->segmentIndex++;
+		conn->segmentSent = 0;
+	}
+}
+
+/* everything up to the Connection line, which depends on the request */
+static int FormatHeader(char *buffer, const char *status, const char *contentType,
+						DWORDLONG contentLength, const char *extraHeaders)
+{
+	char length[24];
+
+	xu64toa(contentLength, length);
+	return wsprintfA(buffer, "HTTP/1.1 %s\r\n"
+					 "Content-Type: %s\r\n"
+					 "Content-Length: %s\r\n"
+					 "%s"
+					 "Server: TinyHTTP/1.0\r\n", status, contentType, length,
+					 extraHeaders ? extraHeaders : "");
+}
+
+static int FormatConnection(connection *conn, char *buffer)
+{
+	return wsprintfA(buffer, "Connection: %s\r\n\r\n", conn->keepAlive ? "keep-alive" : "close");
+}
+
+static int BuildHeader(connection *conn, const char *status, const char *contentType,
+					   DWORDLONG contentLength, const char *extraHeaders)
+{
+	int length = FormatHeader(conn->header, status, contentType, contentLength, extraHeaders);
+
+	return length + FormatConnection(conn, conn->header + length);
+}
+
+/* short plain text responses fit in the header buffer together with their body */
+static void SetTextResponse(connection *conn, const char *status, const char *text, const char *extraHeaders)
+{
+	int length = BuildHeader(conn, status, "text/plain", lstrlenA(text), extraHeaders);
+
+	lstrcpynA(conn->header + length, text, sizeof(conn->header) - length);
+	SetResponse(conn, conn->header, lstrlenA(conn->header));
+}
+
+/*
+ * Appends to the body and returns where the data went. Growing allocates a
+ * new block twice the size of the last one instead of moving what is
+ * already there, and a piece that does not fit the current block starts
+ * the next one, so every appended piece stays contiguous.
+ */
+static char *AppendBody(connection *conn, const char *data, int length)
+{
+	bodyBlock *block = conn->bodyBlocks ? &conn->body[conn->bodyBlocks - 1] : NULL;
+	char *start, *p;
+
+	if (!block || block->length + length > block->capacity)
+	{
+		int capacity = block ? block->capacity * 2 : BUFFER_SIZE;
+
+		if (conn->bodyBlocks >= MAX_BODY_BLOCKS)
+			return NULL;
+
+		while (capacity < length)
+			capacity *= 2;
+
+		block = &conn->body[conn->bodyBlocks];
+		block->data = (char *)HeapAlloc(GetProcessHeap(), 0, capacity);
+		if (!block->data)
+			return NULL;
+
+		block->length = 0;
+		block->capacity = capacity;
+		conn->bodyBlocks++;
+	}
+
+	start = block->data + block->length;
+	block->length += length;
+	conn->bodyLength += length;
+
+	for (p = start; length--; )
+		*p++ = *data++;
+
+	return start;
+}
+
+/* the whole body, one segment per block */
+static void AddBodySegments(connection *conn)
+{
+	int i;
+
+	for (i = 0; i < conn->bodyBlocks; i++)
+		AddSegment(conn, conn->body[i].data, 0, conn->body[i].length);
+}
+
+static void CopyBody(const connection *conn, char *buffer)
+{
+	int i, j;
+
+	for (i = 0; i < conn->bodyBlocks; i++)
+		for (j = 0; j < conn->body[i].length; j++)
+			*buffer++ = conn->body[i].data[j];
+}
+
+static void FormatHttpDate(const FILETIME *fileTime, char *buffer)
+{
+	static const char *days[] = { "Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat" };
+	static const char *months[] = { "Jan", "Feb", "Mar", "Apr", "May", "Jun",
+									 "Jul", "Aug", "Sep", "Oct", "Nov", "Dec" };
+	SYSTEMTIME st;
+
+	FileTimeToSystemTime(fileTime, &st);
+	wsprintfA(buffer, "%s, %02d %s %04d %02d:%02d:%02d GMT", days[st.wDayOfWeek], st.wDay,
+			  months[st.wMonth - 1], st.wYear, st.wHour, st.wMinute, st.wSecond);
+}
+
+/*
+ * Parses a "bytes=" Range value into at most MAX_RANGES ranges. Returns the
+ * number of satisfiable ranges, 0 if the header should be ignored and -1 if
+ * none of the ranges can be satisfied.
+ */
+static int ParseRange(const char *value, int length, DWORDLONG size, DWORDLONG *starts, DWORDLONG *lengths)
+{
+	const char *p = value, *end = value + length;
+	int count = 0, specs = 0;
+
+	if (length < 6 || xstrnicmp(p, "bytes=", 6) != 0)
+		return 0;
+	p += 6;
+
+	while (p < end)
+	{
+		DWORDLONG first = 0, last = 0;
+		int firstDigits = 0, lastDigits = 0;
+
+		while (p < end && (*p == ' ' || *p == '\t' || *p == ','))
+			p++;
+		if (p == end)
+			break;
+
+		for (; p < end && *p >= '0' && *p <= '9'; p++, firstDigits++)
+			first = xmul10add(first, *p - '0');
+		if (p == end || *p != '-')
+			return 0;
+		p++;
+		for (; p < end && *p >= '0' && *p <= '9'; p++, lastDigits++)
+			last = xmul10add(last, *p - '0');
+		while (p < end && (*p == ' ' || *p == '\t'))
+			p++;
+
+		/* more than 18 digits could overflow, and no file is that large anyway */
+		if ((p < end && *p != ',') || (!firstDigits && !lastDigits) ||
+			firstDigits > 18 || lastDigits > 18 || (firstDigits && lastDigits && last < first))
+			return 0;
+
+		if (++specs > MAX_RANGES)
+			return 0;
+
+		if (size == 0)
+			continue;
+
+		if (!firstDigits)
+		{
+			if (last == 0)
+				continue;
+			first = last < size ? size - last : 0;
+			last = size - 1;
+		}
+		else
+		{
+			if (first >= size)
+				continue;
+			if (!lastDigits || last >= size)
+				last = size - 1;
+		}
+
+		starts[count] = first;
+		lengths[count] = last - first + 1;
+		count++;
+	}
+
+	if (specs == 0)
+		return 0;
+
+	return count ? count : -1;
+}
+
+/* size and mtime identify a version, listings only follow the directory's mtime and get a weak tag */
+static void FormatETag(const fileInfo *info, char *buffer)
+{
+	wsprintfA(buffer, "%s\"%lx%08lx-%lx%08lx\"", (info->attributes & FILE_ATTRIBUTE_DIRECTORY) ? "W/" : "",
+			  info->lastWrite.dwHighDateTime, info->lastWrite.dwLowDateTime,
+			  (DWORD)(info->size >> 32), (DWORD)info->size);
+}
+
+static int ParseDigits(const char *p, int count)
+{
+	int value = 0;
+
+	while (count--)
+	{
+		if (*p < '0' || *p > '9')
+			return -1;
+		value = value * 10 + (*p++ - '0');
+	}
+	return value;
+}
+
+/* only the IMF-fixdate form that FormatHttpDate writes, "Sun, 06 Nov 1994 08:49:37 GMT" */
+static int ParseHttpDate(const char *value, int length, FILETIME *fileTime)
+{
+	static const char months[] = "JanFebMarAprMayJunJulAugSepOctNovDec";
+	SYSTEMTIME st;
+	int i;
+
+	if (length < 29 || value[3] != ',' || xstrnicmp(value + 25, " GMT", 4) != 0)
+		return 0;
+	value += 5;
+
+	for (i = 0; i < 12 && xstrnicmp(value + 3, months + i * 3, 3) != 0; i++);
+	if (i == 12)
+		return 0;
+
+	st.wMonth = (WORD)(i + 1);
+	st.wDay = (WORD)ParseDigits(value, 2);
+	st.wYear = (WORD)ParseDigits(value + 7, 4);
+	st.wHour = (WORD)ParseDigits(value + 12, 2);
+	st.wMinute = (WORD)ParseDigits(value + 15, 2);
+	st.wSecond = (WORD)ParseDigits(value + 18, 2);
+	st.wMilliseconds = 0;
+	st.wDayOfWeek = 0;
+
+	return SystemTimeToFileTime(&st, fileTime);
+}
+
+/* If-None-Match uses the weak comparison, so W/ prefixes are ignored on both sides */
+static int ETagListMatches(const char *value, int length, const char *etag)
+{
+	const char *end = value + length;
+	int tagLength;
+
+	if (etag[0] == 'W')
+		etag += 2;
+	tagLength = lstrlenA(etag);
+
+	while (value < end)
+	{
+		const char *item;
+		int i;
+
+		while (value < end && (*value == ' ' || *value == '\t' || *value == ','))
+			value++;
+		if (value < end && *value == '*')
+			return 1;
+		if (end - value >= 2 && value[0] == 'W' && value[1] == '/')
+			value += 2;
+
+		item = value;
+		while (value < end && *value != ',' && *value != ' ' && *value != '\t')
+			value++;
+
+		if (value - item == tagLength)
+		{
+			for (i = 0; i < tagLength && item[i] == etag[i]; i++);
+			if (i == tagLength)
+				return 1;
+		}
+	}
+
+	return 0;
+}
+
+/* If-None-Match wins over If-Modified-Since when both are sent */
+static int NotModified(connection *conn, const char *etag, const FILETIME *lastWrite)
+{
+	const char *value;
+	FILETIME since, seconds;
+	SYSTEMTIME st;
+	int length;
+
+	value = FindHeader(conn, "If-None-Match", &length);
+	if (value)
+		return ETagListMatches(value, length, etag);
+
+	value = FindHeader(conn, "If-Modified-Since", &length);
+	if (!value || !ParseHttpDate(value, length, &since))
+		return 0;
+
+	/* HTTP dates have whole seconds */
+	FileTimeToSystemTime(lastWrite, &st);
+	st.wMilliseconds = 0;
+	SystemTimeToFileTime(&st, &seconds);
+	return CompareFileTime(&seconds, &since) <= 0;
+}
+
+static void SetNotModified(connection *conn, const char *validators)
+{
+	int length = wsprintfA(conn->header, "HTTP/1.1 304 Not Modified\r\n%sServer: TinyHTTP/1.0\r\n", validators);
+
+	length += FormatConnection(conn, conn->header + length);
+	SetResponse(conn, conn->header, length);
+}
+
+/* a Range only applies while the If-Range validator, if any, still matches */
+static int IfRangeMatches(connection *conn, const char *lastModified, const char *etag)
+{
+	int length;
+	const char *value = FindHeader(conn, "If-Range", &length);
+
+	if (!value)
+		return 1;
+
+	/* entity tags need the strong comparison here */
+	if (*value == '"')
+	{
+		int i;
+
+		if (etag[0] == 'W' || length != lstrlenA(etag))
+			return 0;
+		for (i = 0; i < length && value[i] == etag[i]; i++);
+		return i == length;
+	}
+
+	return length == lstrlenA(lastModified) && xstrnicmp(value, lastModified, length) == 0;
+}
+
+static int SetMultipartResponse(connection *conn, const char *mimeType, DWORDLONG fileSize,
+								const DWORDLONG *starts, const DWORDLONG *lengths, int count,
+								const char *extraHeaders)
+{
+	char boundary[24], part[256], first[24], last[24], size[24];
+	char contentType[64];
+	const char *parts[MAX_RANGES + 1];
+	int partLengths[MAX_RANGES + 1];
+	DWORDLONG total = 0;
+	int i, length;
+
+	wsprintfA(boundary, "%08lx%08lx", GetTickCount(), (DWORD)(DWORD_PTR)conn);
+	xu64toa(fileSize, size);
+
+	for (i = 0; i < count; i++)
+	{
+		xu64toa(starts[i], first);
+		xu64toa(starts[i] + lengths[i] - 1, last);
+		length = wsprintfA(part, "\r\n--%s\r\n"
+						   "Content-Type: %s\r\n"
+						   "Content-Range: bytes %s-%s/%s\r\n\r\n", boundary, mimeType, first, last, size);
+
+		parts[i] = AppendBody(conn, part, length);
+		partLengths[i] = length;
+		if (!parts[i])
+			return 0;
+		total += length + lengths[i];
+	}
+
+	length = wsprintfA(part, "\r\n--%s--\r\n", boundary);
+	parts[count] = AppendBody(conn, part, length);
+	partLengths[count] = length;
+	if (!parts[count])
+		return 0;
+	total += length;
+
+	wsprintfA(contentType, "multipart/byteranges; boundary=%s", boundary);
+	SetResponse(conn, conn->header, BuildHeader(conn, "206 Partial Content", contentType, total, extraHeaders));
+
+	/* the part headers live in the body, whose blocks never move */
+	for (i = 0; i < count; i++)
+	{
+		AddSegment(conn, parts[i], 0, partLengths[i]);
+		AddSegment(conn, NULL, starts[i], lengths[i]);
+	}
+	AddSegment(conn, parts[count], 0, partLengths[count]);
+	return 1;
+}
+
+/* the cached headers, this connection's Connection line and the cached body */
+static void SetCachedResponse(connection *conn, cachedResponse *entry)
+{
+	conn->cached = entry;
+	SetResponse(conn, entry->data, entry->headLength);
+	AddSegment(conn, conn->header, 0, FormatConnection(conn, conn->header));
+	AddSegment(conn, entry->data + entry->headLength, 0, entry->bodyLength);
+}
+
+/* true if the open file is still what info describes; current gets what it is */
+static int HandleMatches(HANDLE hFile, const fileInfo *info, fileInfo *current)
+{
+	BY_HANDLE_FILE_INFORMATION byHandle;
+
+	*current = *info;
+	if (!GetFileInformationByHandle(hFile, &byHandle))
+		return 1;
+
+	current->size = ((DWORDLONG)byHandle.nFileSizeHigh << 32) | byHandle.nFileSizeLow;
+	current->lastWrite = byHandle.ftLastWriteTime;
+	return current->size == info->size && CompareFileTime(&current->lastWrite, &info->lastWrite) == 0;
+}
+
+/*
+ * Sets up the response for the file described by info. Returns 0 with
+ * nothing set if the file turns out to differ from info, which then holds
+ * the metadata cache's view, and current what the file really is.
+ */
+static int SendFileAs(connection *conn, const char *filePath, const fileInfo *info, const char *encoding, int vary,
+					  fileInfo *current)
+{
+	const char *mimeType, *range, *cacheKey = filePath;
+	HANDLE hFile;
+	DWORDLONG fileSize, total, starts[MAX_RANGES], lengths[MAX_RANGES];
+	char lastModified[32], etag[48], validators[192], extraHeaders[320], first[24], last[24], size[24];
+	int rangeLength, rangeCount = 0, i, store;
+	wchar_t *widePath;
+	cachedResponse *entry = NULL;
+	mappedFile *mapped;
+
+	/* size, date and type come from the metadata cache, checked once a handle is open */
+	fileSize = info->size;
+	FormatHttpDate(&info->lastWrite, lastModified);
+	FormatETag(info, etag);
+	xu64toa(fileSize, size);
+
+	wsprintfA(validators, "ETag: %s\r\nLast-Modified: %s\r\n%s", etag, lastModified,
+			  vary ? "Vary: Accept-Encoding\r\n" : "");
+	if (NotModified(conn, etag, &info->lastWrite))
+	{
+		SetNotModified(conn, validators);
+		return 1;
+	}
+
+	/* 304s leave it out, it describes the body */
+	if (encoding)
+	{
+		lstrcatA(validators, "Content-Encoding: ");
+		lstrcatA(validators, encoding);
+		lstrcatA(validators, "\r\n");
+	}
+
+	mimeType = info->mimeType;
+	wsprintfA(extraHeaders, "mimeType: %s\r\n", mimeType);
+	LogWrite(LOG_REQUEST, extraHeaders);
+
+	range = FindHeader(conn, "Range", &rangeLength);
+	if (range && IfRangeMatches(conn, lastModified, etag))
+		rangeCount = ParseRange(range, rangeLength, fileSize, starts, lengths);
+
+	if (rangeCount < 0)
+	{
+		wsprintfA(extraHeaders, "Content-Range: bytes */%s\r\n", size);
+		SetTextResponse(conn, "416 Range Not Satisfiable", "416 Range Not Satisfiable\n", extraHeaders);
+		return 1;
+	}
+
+	/*
+	 * A sidecar sent in place of its original has the original's type and a
+	 * Content-Encoding in its head, unlike the same file requested by name.
+	 * '|' cannot occur in a file name, so the two never share an entry.
+	 */
+	if (encoding)
+	{
+		char *key = (char *)ArenaAlloc(conn->scratch, lstrlenA(filePath) + lstrlenA(encoding) + 2);
+
+		if (key)
+		{
+			lstrcpyA(key, filePath);
+			lstrcatA(key, "|");
+			lstrcatA(key, encoding);
+		}
+		cacheKey = key;
+	}
+
+	store = rangeCount == 0 && cacheKey && ResponseCacheable(fileSize);
+	if (store)
+	{
+		entry = FindCachedResponse(cacheKey, info);
+		if (entry)
+		{
+			SetCachedResponse(conn, entry);
+			return 1;
+		}
+	}
+
+	/* a large file another connection is sending needs neither a handle nor a mapping of its own */
+	mapped = !store && MapCacheable(fileSize) ? FindMappedFile(filePath, info) : NULL;
+	hFile = INVALID_HANDLE_VALUE;
+
+	if (!mapped)
+	{
+		widePath = (wchar_t *)ArenaAlloc(conn->scratch, MAX_PATH_LEN * sizeof(wchar_t));
+		if (!widePath)
+		{
+			SetTextResponse(conn, "500 Internal Server Error", "500 Internal Server Error\n", NULL);
+			return 1;
+		}
+
+		/* the response cache reads synchronously, the event loop with overlapped reads */
+		if (Utf8ToWide(filePath, widePath, MAX_PATH_LEN))
+			hFile = CreateFileW(widePath, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+								FILE_ATTRIBUTE_NORMAL | (asyncReads && !store ? FILE_FLAG_OVERLAPPED : 0), NULL);
+		if (hFile == INVALID_HANDLE_VALUE)
+		{
+			SetTextResponse(conn, "404 Not Found", "404 Not Found\n", NULL);
+			return 1;
+		}
+
+		/* every length below comes from fileSize, a stale one would frame the response wrongly */
+		if (!HandleMatches(hFile, info, current))
+		{
+			CloseHandle(hFile);
+			return 0;
+		}
+	}
+
+	if (store)
+	{
+		char head[sizeof(conn->header)];
+
+		wsprintfA(extraHeaders, "Accept-Ranges: bytes\r\n%s", validators);
+		entry = StoreCachedResponse(cacheKey, info, hFile, head,
+									FormatHeader(head, "200 OK", mimeType, fileSize, extraHeaders));
+		if (entry)
+		{
+			CloseHandle(hFile);
+			SetCachedResponse(conn, entry);
+			return 1;
+		}
+
+		/* fall back to sending from the file */
+		SetFilePointer(hFile, 0, NULL, FILE_BEGIN);
+	}
+
+	/* the mapping keeps the file open, the handle is not needed any more */
+	if (!mapped && !store && MapCacheable(fileSize))
+	{
+		mapped = CreateMappedFile(filePath, info, hFile);
+		if (mapped)
+		{
+			CloseHandle(hFile);
+			hFile = INVALID_HANDLE_VALUE;
+		}
+	}
+
+	conn->hFile = hFile;
+	conn->mapped = mapped;
+	conn->fileLength = fileSize;
+	conn->asyncFile = hFile != INVALID_HANDLE_VALUE && asyncReads && !store;
+
+	if (rangeCount == 0)
+	{
+		total = fileSize;
+		wsprintfA(extraHeaders, "Accept-Ranges: bytes\r\n%s", validators);
+		SetResponse(conn, conn->header, BuildHeader(conn, "200 OK", mimeType, fileSize, extraHeaders));
+		AddSegment(conn, NULL, 0, fileSize);
+	}
+	else if (rangeCount == 1)
+	{
+		total = lengths[0];
+		xu64toa(starts[0], first);
+		xu64toa(starts[0] + lengths[0] - 1, last);
+		wsprintfA(extraHeaders, "Accept-Ranges: bytes\r\n%sContent-Range: bytes %s-%s/%s\r\n",
+				  validators, first, last, size);
+		SetResponse(conn, conn->header, BuildHeader(conn, "206 Partial Content", mimeType, lengths[0], extraHeaders));
+		AddSegment(conn, NULL, starts[0], lengths[0]);
+	}
+	else
+	{
+		for (total = 0, i = 0; i < rangeCount; i++)
+			total += lengths[i];
+
+		wsprintfA(extraHeaders, "Accept-Ranges: bytes\r\n%s", validators);
+		if (!SetMultipartResponse(conn, mimeType, fileSize, starts, lengths, rangeCount, extraHeaders))
+		{
+			ResetResponse(conn);
+			SetTextResponse(conn, "500 Internal Server Error", "500 Internal Server Error\n", NULL);
+			return 1;
+		}
+	}
+
+	/* small files are cheaper with a single read and send */
+	if (mapped)
+		conn->sendPath = SEND_MAPPED;
+	else if (zeroCopyEnabled && total >= zeroCopyMinimum)
+		conn->sendPath = SEND_TRANSMITFILE;
+	return 1;
+}
+
+void SendFile(connection *conn, const char *filePath, const fileInfo *info, const char *encoding, int vary)
+{
+	fileInfo current;
+
+	if (SendFileAs(conn, filePath, info, encoding, vary, &current))
+		return;
+
+	/* the file changed within the metadata cache's TTL, describe it as the handle found it */
+	InvalidateFileInfo(filePath);
+	if (!SendFileAs(conn, filePath, &current, encoding, vary, &current))
+		SetTextResponse(conn, "503 Service Unavailable", "503 Service Unavailable\n", NULL);
+}
+
+/*
+ * Sends a compressed sidecar of a text file in its place when the client
+ * accepts the coding and the sidecar is at least as new as the file, so a
+ * stale one is never served. The sidecar carries its own ETag and length.
+ */
+static void SendNegotiated(connection *conn, const char *filePath, const fileInfo *info)
+{
+	static const char *const codings[] = { "br", "zstd", "gzip" };
+	static const char *const suffixes[] = { ".br", ".zst", ".gz" };
+	const char *accept;
+	char *variantPath;
+	fileInfo variant;
+	int acceptLength, i;
+
+	if (!precompressed || !Compressible(info->mimeType))
+	{
+		SendFile(conn, filePath, info, NULL, 0);
+		return;
+	}
+
+	accept = FindHeader(conn, "Accept-Encoding", &acceptLength);
+	variantPath = accept ? (char *)ArenaAlloc(conn->scratch, MAX_PATH_LEN + 8) : NULL;
+
+	for (i = 0; variantPath && i < 3; i++)
+	{
+		if (!AcceptsEncoding(accept, acceptLength, codings[i]))
+			continue;
+
+		lstrcpyA(variantPath, filePath);
+		lstrcatA(variantPath, suffixes[i]);
+		if (LookupFileInfo(variantPath, &variant) && !(variant.attributes & FILE_ATTRIBUTE_DIRECTORY) &&
+			CompareFileTime(&variant.lastWrite, &info->lastWrite) >= 0)
+		{
+			variant.mimeType = info->mimeType;
+			SendFile(conn, variantPath, &variant, codings[i], 1);
+			return;
+		}
+	}
+
+	SendFile(conn, filePath, info, NULL, 1);
+}
+
+void SendDirectoryListing(connection *conn, const char *path, const fileInfo *info)
+{
+	HANDLE hFind;
+	WIN32_FIND_DATAW findData;
+	wchar_t *searchPath, *widePath;
+	char *htmlLine, *filenameUtf8;
+	char lastModified[32], etag[48], validators[128];
+	cachedResponse *entry;
+	DWORD ticket;
+	int ok;
+
+	/* adding, removing or renaming an entry updates the directory's mtime */
+	FormatHttpDate(&info->lastWrite, lastModified);
+	FormatETag(info, etag);
+	wsprintfA(validators, "ETag: %s\r\nLast-Modified: %s\r\n", etag, lastModified);
+	if (NotModified(conn, etag, &info->lastWrite))
+	{
+		SetNotModified(conn, validators);
+		return;
+	}
+
+	entry = FindCachedListing(path, &ticket);
+	if (entry)
+	{
+		SetCachedResponse(conn, entry);
+		return;
+	}
+
+	searchPath = (wchar_t *)ArenaAlloc(conn->scratch, (MAX_PATH_LEN + 2) * sizeof(wchar_t));
+	widePath = (wchar_t *)ArenaAlloc(conn->scratch, MAX_PATH_LEN * sizeof(wchar_t));
+	htmlLine = (char *)ArenaAlloc(conn->scratch, MAX_PATH_LEN * 2 + 100);
+	filenameUtf8 = (char *)ArenaAlloc(conn->scratch, MAX_PATH_LEN);
+	if (!searchPath || !widePath || !htmlLine || !filenameUtf8)
+	{
+		SetTextResponse(conn, "500 Internal Server Error", "500 Internal Server Error\n", NULL);
+		return;
+	}
+
+	if (Utf8ToWide(path, widePath, MAX_PATH_LEN))
+	{
+		wsprintfW(searchPath, L"%s\\*", (lstrcmpA(path, ".") == 0) ? L"." : widePath);
+		hFind = FindFirstFileW(searchPath, &findData);
+	}
+	else
+		hFind = INVALID_HANDLE_VALUE;
+	if (hFind == INVALID_HANDLE_VALUE)
+	{
+		SetTextResponse(conn, "404 Not Found", "404 Not Found\n", NULL);
+		return;
+	}
+
+	ok = AppendBody(conn, HTML_START, sizeof(HTML_START) - 1) != NULL;
+
+	if (ok && lstrcmpA(path, "www") != 0)
+	{
+		const char parentLink[] = "	<div class=\"file\"><a href=\"../\">../</a> (Parent Directory)</div>\n";
+		ok = AppendBody(conn, parentLink, sizeof(parentLink) - 1) != NULL;
+	}
+
+	while (ok)
+	{
+		/* names with unpaired surrogates have no UTF-8 form and could not be requested anyway */
+		if (lstrcmpW(findData.cFileName, L".") != 0 && lstrcmpW(findData.cFileName, L"..") != 0 &&
+			WideToUtf8(findData.cFileName, filenameUtf8, MAX_PATH_LEN))
+		{
+
+			if (findData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) {
+				wsprintfA(htmlLine,
+					"	<div class=\"dir\"><a href=\"%s/\">%s/</a></div>\n",
+					filenameUtf8, filenameUtf8);
+			} else {
+				wsprintfA(htmlLine,
+					"	<div class=\"file\"><a href=\"%s\">%s</a></div>\n",
+					filenameUtf8, filenameUtf8);
+			}
+			ok = AppendBody(conn, htmlLine, lstrlenA(htmlLine)) != NULL;
+		}
+
+		if (FindNextFileW(hFind, &findData) == 0)
+			break;
+	}
+
+	FindClose(hFind);
+
+	if (ok)
+		ok = AppendBody(conn, HTML_END, sizeof(HTML_END) - 1) != NULL;
+
+	if (!ok)
+	{
+		ResetResponse(conn);
+		SetTextResponse(conn, "500 Internal Server Error", "500 Internal Server Error\n", NULL);
+		return;
+	}
+
+	if (ticket)
+	{
+		char head[sizeof(conn->header)];
+
+		entry = CreateCachedResponse(head, FormatHeader(head, "200 OK", "text/html; charset=utf-8", conn->bodyLength, validators),
+									 NULL, conn->bodyLength);
+		if (entry)
+		{
+			CopyBody(conn, entry->data + entry->headLength);
+			StoreCachedListing(path, ticket, entry);
+			ResetResponse(conn);
+			SetCachedResponse(conn, entry);
+			return;
+		}
+	}
+
+	SetResponse(conn, conn->header, BuildHeader(conn, "200 OK", "text/html; charset=utf-8", conn->bodyLength, validators));
+	AddBodySegments(conn);
+}
+
+/* the server's counters, Prometheus text or JSON, built fresh for every request */
+static void SendStats(connection *conn, int json)
+{
+	char *text = (char *)ArenaAlloc(conn->scratch, STATS_TEXT_SIZE);
+
+	if (!text || !AppendBody(conn, text, FormatStats(text, STATS_TEXT_SIZE, json)))
+	{
+		SetTextResponse(conn, "500 Internal Server Error", "500 Internal Server Error\n", NULL);
+		return;
+	}
+
+	SetResponse(conn, conn->header, BuildHeader(conn, "200 OK",
+												json ? "application/json" : "text/plain; version=0.0.4; charset=utf-8",
+												conn->bodyLength, "Cache-Control: no-store\r\n"));
+	AddBodySegments(conn);
+}
+
+/* feeds the bytes received so far to the parser, true once the head is complete or rejected */
+int RequestComplete(connection *conn)
+{
+	return HttpParseRequest(&conn->request, conn->requestBuffer, conn->requestLength, BUFFER_SIZE - 1) != HTTP_INCOMPLETE;
+}
+
+static int WantsKeepAlive(connection *conn)
+{
+	const char *value;
+	int length;
+
+	if (keepAliveTimeout <= 0 || conn->requestCount + 1 >= keepAliveMax)
+		return 0;
+
+	value = FindHeader(conn, "Connection", &length);
+
+	/* HTTP/1.1 keeps the connection open unless told otherwise, 1.0 only on request */
+	if (HttpViewEquals(&conn->request.version, "HTTP/1.1"))
+		return !value || !HeaderHasToken(value, length, "close");
+
+	return value && HeaderHasToken(value, length, "keep-alive");
+}
+
+static void ProcessRequest(connection *conn)
+{
+	char *p;
+	char method[16], *path, *decodedPath, *logBuffer;
+	fileInfo info;
+	int len;
+
+	path = (char *)ArenaAlloc(conn->scratch, MAX_PATH_LEN);
+	decodedPath = (char *)ArenaAlloc(conn->scratch, MAX_PATH_LEN + 4);
+	logBuffer = (char *)ArenaAlloc(conn->scratch, MAX_PATH_LEN + 64);
+	if (!path || !decodedPath || !logBuffer)
+	{
+		conn->keepAlive = 0;
+		SetTextResponse(conn, "500 Internal Server Error", "500 Internal Server Error\n", NULL);
+		return;
+	}
+
+	if (conn->request.result == HTTP_ERROR)
+	{
+		wsprintfA(logBuffer, "Rejected request: %s\r\n", conn->request.error);
+		LogWrite(LOG_INFO, logBuffer);
+
+		/* there is no telling where the next request would start */
+		conn->keepAlive = 0;
+		lstrcpyA(logBuffer, conn->request.error);
+		lstrcatA(logBuffer, "\n");
+		SetTextResponse(conn, conn->request.error, logBuffer, NULL);
+		return;
+	}
+
+	if (!HttpCopyView(&conn->request.method, method, sizeof(method)) ||
+		!HttpCopyView(&conn->request.target, path, MAX_PATH_LEN))
+	{
+		SetTextResponse(conn, "400 Bad Request", "400 Bad Request\n", NULL);
+		return;
+	}
+
+	/* the request line as one message, cut short if it is very long */
+	wsprintfA(logBuffer, "Request: %s ", method);
+	len = lstrlenA(logBuffer);
+	lstrcpynA(logBuffer + len, path, 1001);
+	if (lstrlenA(path) > 1000)
+		lstrcatA(logBuffer, "... [truncated]");
+	lstrcatA(logBuffer, "\r\n");
+	LogWrite(LOG_REQUEST, logBuffer);
+
+	conn->keepAlive = WantsKeepAlive(conn);
+
+	/* :-) */
+	{
+		char safePath[256];
+		int pathLen = lstrlenA(path);
+		if (pathLen > 250)
+		{
+			lstrcpynA(safePath, path, 247);
+			lstrcatA(safePath, "...");
+		}
+		else
+		{
+			lstrcpyA(safePath, path);
+		}
+		wsprintfA(logBuffer, "Method: %s: %s\r\n", method, safePath);
+		LogWrite(LOG_REQUEST, logBuffer);
+	}
+
+	if (lstrcmpA(method, "GET") != 0)
+	{
+		conn->keepAlive = 0;
+		SetTextResponse(conn, "418 I'm a teapot", "418 I'm a teapot\nThe requested entity body is short and stout.\n", NULL);
+		return;
+	}
+
+	if (statsEndpoint && (lstrcmpA(path, STATS_PATH) == 0 || lstrcmpA(path, STATS_PATH ".json") == 0))
+	{
+		SendStats(conn, path[sizeof(STATS_PATH) - 1] != '\0');
+		return;
+	}
+
+	/* decoded after room for the www\\ prefix, so it needs no second buffer */
+	UrlDecode(decodedPath + 4, path + 1);
+	decodedPath[0] = 'w';
+	decodedPath[1] = 'w';
+	decodedPath[2] = 'w';
+	decodedPath[3] = decodedPath[4] ? '\\' : '\0';
+
+	for (p = decodedPath; *p; p++)
+		if (*p == '/') *p = '\\';
+
+	len = lstrlenA(decodedPath);
+	if (len > 1 && decodedPath[len - 1] == '\\')
+		decodedPath[len - 1] = '\0';
+	
+	wsprintfA(logBuffer, "Decoded path: '%s'\r\n", decodedPath);
+	LogWrite(LOG_REQUEST, logBuffer);
+
+	if (!LookupFileInfo(decodedPath, &info))
+	{
+		wsprintfA(logBuffer, "File not found: %s\r\n", decodedPath);
+		LogWrite(LOG_REQUEST, logBuffer);
+		SetTextResponse(conn, "404 Not Found", "404 Not Found\n", NULL);
+		return;
+	}
+
+	if (info.attributes & FILE_ATTRIBUTE_DIRECTORY)
+		SendDirectoryListing(conn, decodedPath, &info);
+	else
+		SendNegotiated(conn, decodedPath, &info);
+}
+
+void HandleRequest(connection *conn)
+{
+	if (!conn->requestBuffer || conn->requestLength <= 0)
+		return;
+
+	conn->keepAlive = 0;
+	conn->requestStart = StatsClock();
+	conn->firstByte = 0;
+
+	/* the scratch memory of the previous request on this thread is reused */
+	conn->scratch = ThreadScratch();
+
+	/* a rejected head has no known end, the connection is closed after the answer */
+	if (RequestComplete(conn) && conn->request.result == HTTP_COMPLETE)
+		conn->requestSize = conn->request.headLength;
+	else
+		conn->requestSize = conn->requestLength;
+
+	ProcessRequest(conn);
+}
+
+/* drops the request just answered, returns 0 if the connection should close */
+int NextRequest(connection *conn)
+{
+	int i, remaining;
+
+	if (!conn->keepAlive)
+		return 0;
+
+	remaining = conn->requestLength - conn->requestSize;
+	for (i = 0; i < remaining; i++)
+		conn->requestBuffer[i] = conn->requestBuffer[conn->requestSize + i];
+
+	conn->requestLength = remaining;
+	conn->requestSize = 0;
+	conn->requestCount++;
+	HttpInitRequest(&conn->request);
+	return 1;
+}
+
+static int SendAll(SOCKET s, const char *data, int length)
+{
+	while (length > 0)
+	{
+		int sent = send(s, data, length, 0);
+		if (sent <= 0)
+			return 0;
+
+		data += sent;
+		length -= sent;
+	}
+	return 1;
+}
+
+#ifdef _WINSOCK2API_
+/* sends consecutive memory segments from first in one call, returns how many went out */
+static int SendGathered(connection *conn, int first)
+{
+	WSABUF wsaBuf[MAX_GATHER];
+	DWORD count = 0, bytesSent;
+	int i;
+
+	for (i = first; i < conn->segmentCount && conn->segments[i].data && count < MAX_GATHER; i++)
+	{
+		wsaBuf[count].buf = (char *)conn->segments[i].data;
+		wsaBuf[count].len = (DWORD)conn->segments[i].length;
+		count++;
+	}
+
+	if (WSASend(conn->socket, wsaBuf, count, &bytesSent, 0, NULL, NULL) == SOCKET_ERROR)
+		return 0;
+
+	return (int)count;
+}
+#endif
+
+/* file data with the header in front of it in one send, so a small response is one packet */
+static int SendWithHead(connection *conn, const segment *head, const char *data, DWORD length)
+{
+#ifdef _WINSOCK2API_
+	WSABUF wsaBuf[2];
+	DWORD bytesSent;
+
+	if (head)
+	{
+		wsaBuf[0].buf = (char *)head->data;
+		wsaBuf[0].len = (DWORD)head->length;
+		wsaBuf[1].buf = (char *)data;
+		wsaBuf[1].len = length;
+		return WSASend(conn->socket, wsaBuf, 2, &bytesSent, 0, NULL, NULL) != SOCKET_ERROR;
+	}
+#endif
+
+	if (head && !SendAll(conn->socket, head->data, (int)head->length))
+		return 0;
+
+	return SendAll(conn->socket, data, (int)length);
+}
+
+static int SendFileRange(connection *conn, const segment *head, const segment *range)
+{
+	DWORDLONG remaining = range->length;
+	LONG offsetHigh = (LONG)(range->offset >> 32);
+
+	if (conn->mapped)
+	{
+		DWORDLONG position = range->offset;
+
+		/* straight from the shared mapping, a window at a time */
+		while (remaining > 0)
+		{
+			DWORD length;
+			const char *data = MappedBytes(conn, position, &length);
+
+			if (!data)
+				return 0;
+			if (length > remaining)
+				length = (DWORD)remaining;
+			if (!SendWithHead(conn, head, data, length))
+				return 0;
+
+			head = NULL;
+			position += length;
+			remaining -= length;
+			conn->fileSent += length;
+		}
+		return 1;
+	}
+
+	if (SetFilePointer(conn->hFile, (LONG)(DWORD)range->offset, &offsetHigh, FILE_BEGIN) == INVALID_SET_FILE_POINTER &&
+		GetLastError() != NO_ERROR)
+		return 0;
+
+#ifdef _WINSOCK2API_
+	if (conn->sendPath == SEND_TRANSMITFILE)
+	{
+		TRANSMIT_FILE_BUFFERS transmitBuffers;
+
+		transmitBuffers.Tail = NULL;
+		transmitBuffers.TailLength = 0;
+
+		while (remaining > 0)
+		{
+			DWORD chunk = remaining > MAX_TRANSMIT ? MAX_TRANSMIT : (DWORD)remaining;
+
+			if (head)
+			{
+				transmitBuffers.Head = (LPVOID)head->data;
+				transmitBuffers.HeadLength = (DWORD)head->length;
+			}
+
+			if (!TransmitFile(conn->socket, conn->hFile, chunk, 0, NULL, head ? &transmitBuffers : NULL, 0))
+				return 0;
+
+			head = NULL;
+			remaining -= chunk;
+			conn->fileSent += chunk;
+		}
+		return 1;
+	}
+#endif
+
+	while (remaining > 0)
+	{
+		DWORD bytesRead, chunk = remaining > BUFFER_SIZE ? BUFFER_SIZE : (DWORD)remaining;
 
-int DirectoryExists(const wchar_t *path)
-{
-	DWORD attrib = GetFileAttributesW(path);
-	if (attrib == INVALID_FILE_ATTRIBUTES)
-		return 0;
+		if (!ReadFile(conn->hFile, conn->fileBuffer, chunk, &bytesRead, NULL) || bytesRead == 0)
+			return 0;
 
-	return (attrib & FILE_ATTRIBUTE_DIRECTORY);
-}
+		if (!SendWithHead(conn, head, conn->fileBuffer, bytesRead))
+			return 0;
 
-int HexToInt(char c)
-{
-	if (c >= '0' && c <= '9') return c - '0';
-	if (c >= 'A' && c <= 'F') return c - 'A' + 10;
-	if (c >= 'a' && c <= 'f') return c - 'a' + 10;
-	return 0;
+		head = NULL;
+		remaining -= bytesRead;
+		conn->fileSent += bytesRead;
+	}
+	return 1;
 }
 
-void UrlDecode(char *dst, const char *src)
+static int SendResponse(connection *conn)
 {
-	char *p = dst;
-	char *end = dst + MAX_PATH_LEN - 1;
-	
-	while (*src && p < end)
+	int i, ok = 1;
+
+	for (i = 0; ok && i < conn->segmentCount; i++)
 	{
-		if (*src == '%' && src[1] && src[2])
+		const segment *seg = &conn->segments[i];
+		const segment *head = NULL;
+
+		/* the header goes out with the first chunk of the file behind it */
+		if (seg->data && i + 1 < conn->segmentCount && !conn->segments[i + 1].data)
 		{
-			*p++ = (char)(HexToInt(src[1]) * 16 + HexToInt(src[2]));
-			src += 3;
+			head = seg;
+			seg = &conn->segments[++i];
 		}
-		else if (*src == '+')
+
+#ifdef _WINSOCK2API_
+		if (seg->data && i + 1 < conn->segmentCount && conn->segments[i + 1].data)
 		{
-			*p++ = ' ';
-			src++;
+			int sent = SendGathered(conn, i);
+
+			ok = sent > 0;
+			i += sent - 1;
+			continue;
 		}
+#endif
+
+		if (seg->data)
+			ok = SendAll(conn->socket, seg->data, (int)seg->length);
 		else
-		{
-			*p++ = *src++;
-		}
+			ok = SendFileRange(conn, head, seg);
+
+		if (ok && !conn->firstByte)
+			conn->firstByte = StatsClock();
 	}
-	*p = '\0';
+
+	FinishResponse(conn, ok);
+	return ok;
 }
 
-void SendFile(SOCKET clientSocket, const char *filePath, char *fileBuffer)
+static int ReadRequest(connection *conn)
 {
-	const char *mimeType;
-	HANDLE hFile;
-	char header[512];
-	wchar_t widePath[MAX_PATH_LEN];
+	while (!RequestComplete(conn))
+	{
+		int bytesRead = recv(conn->socket, conn->requestBuffer + conn->requestLength,
+							 BUFFER_SIZE - 1 - conn->requestLength, 0);
+		if (bytesRead <= 0)
+			return 0;
 
-	Utf8ToWide(filePath, widePath, MAX_PATH_LEN);
+		conn->requestLength += bytesRead;
+	}
+	return 1;
+}
+
+void CloseConnection(connection *conn)
+{
+	struct sockaddr_in clientAddr;
+	int addr_len = sizeof(clientAddr);
+	char buffer[256];
+
+	shutdown(conn->socket, SD_SEND);
 
-	hFile = CreateFileW(widePath, GENERIC_READ, FILE_SHARE_READ, 
-							   NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
-	if (hFile == INVALID_HANDLE_VALUE)
+	if (getpeername(conn->socket, (struct sockaddr*)&clientAddr, &addr_len) == 0)
 	{
-		send(clientSocket, HTTP_404, sizeof(HTTP_404) - 1, 0);
-		return;
+		wsprintfA(buffer, "Connection from %s:%d closed\r\n", 
+				 inet_ntoa(clientAddr.sin_addr), 
+				 ntohs(clientAddr.sin_port));
+		LogWrite(LOG_REQUEST, buffer);
 	}
+	
+	closesocket(conn->socket);
+	CountConnection(-1);
+}
 
-	mimeType = GetMimeType(filePath);
-	ConsoleWrite("mimeType: ");
-	ConsoleWrite(mimeType);
-	ConsoleWrite("\n");
-	wsprintfA(header, "HTTP/1.1 200 OK\r\n"
-					 "Content-Type: %s\r\n"
-					 "Content-Length: %lu\r\n"
-					 "Server: TinyHTTP/1.0\r\n"
-					 "Connection: close\r\n\r\n", GetMimeType(filePath), GetFileSize(hFile, NULL));
-	send(clientSocket, header, lstrlenA(header), 0);
+void ServeConnection(connection *conn)
+{
+	if (conn->requestBuffer)
+	{
+		if (keepAliveTimeout > 0)
+		{
+			DWORD timeout = (DWORD)keepAliveTimeout * 1000;
+			setsockopt(conn->socket, SOL_SOCKET, SO_RCVTIMEO, (char *)&timeout, sizeof(timeout));
+		}
 
-	if (fileBuffer)
+		while (ReadRequest(conn))
+		{
+			HandleRequest(conn);
+			if (!SendResponse(conn) || !NextRequest(conn))
+				break;
+		}
+	}
+	else
 	{
-		DWORD bytesRead;
-		while (ReadFile(hFile, fileBuffer, BUFFER_SIZE, &bytesRead, NULL) && bytesRead > 0)
-			send(clientSocket, fileBuffer, (int)bytesRead, 0);
+		send(conn->socket, HTTP_500, sizeof(HTTP_500) - 1, 0);
 	}
 
-	CloseHandle(hFile);
+	CloseConnection(conn);
 }
 
-void SendDirectoryListing(SOCKET clientSocket, const char *path)
+DWORD WINAPI ClientThread(LPVOID param)
 {
-	HANDLE hFind;
-	WIN32_FIND_DATAW findData;
-	wchar_t searchPath[MAX_PATH_LEN];
-	char htmlLine[MAX_PATH_LEN + 100];
-	char filenameUtf8[MAX_PATH_LEN];
-	wchar_t widePath[MAX_PATH_LEN];
-	
-	Utf8ToWide(path, widePath, MAX_PATH_LEN);
-	wsprintfW(searchPath, L"%s\\*", (lstrcmpA(path, ".") == 0) ? L"." : widePath);
+	connection conn;
+	char *buffers = GetConnectionBuffers();
 
-	hFind = FindFirstFileW(searchPath, &findData);
-	if (hFind == INVALID_HANDLE_VALUE)
-	{
-		send(clientSocket, HTTP_404, sizeof(HTTP_404) - 1, 0);
-		return;
-	}
+	InitConnection(&conn, (SOCKET)param, buffers);
+	ServeConnection(&conn);
+	PutConnectionBuffers(buffers);
+
+	ScratchThreadDone();
+	StatsThreadDone();
+	LogThreadDone();
+	return 0;
+}
+
+static void GetIniPath(wchar_t *iniPath)
+{
+	wchar_t *p, *lastSlash;
 
-	send(clientSocket, HTTP_HEADER, sizeof(HTTP_HEADER) - 1, 0);
-	send(clientSocket, HTML_START, sizeof(HTML_START) - 1, 0);
+	GetModuleFileNameW(NULL, iniPath, MAX_PATH);
 
-	if (lstrcmpA(path, "www") != 0)
+	lastSlash = iniPath;
+	for (p = iniPath; *p; p++)
 	{
-		const char parentLink[] = "	<div class=\"file\"><a href=\"../\">../</a> (Parent Directory)</div>\n";
-		send(clientSocket, parentLink, sizeof(parentLink) - 1, 0);
+		if (*p == L'\\' || *p == L'/')
+			lastSlash = p;
 	}
 
-	do
-	{
-		if (lstrcmpW(findData.cFileName, L".") == 0 || lstrcmpW(findData.cFileName, L"..") == 0)
-			continue;
+	lstrcpyW(lastSlash + 1, L"tinyhttp.ini");
+}
 
-		WideToUtf8(findData.cFileName, filenameUtf8, sizeof(filenameUtf8));
+int ReadIntFromIni(const wchar_t *key, int defaultValue)
+{
+	wchar_t iniPath[MAX_PATH];
 
-		if (findData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) {
-			wsprintfA(htmlLine,
-				"	<div class=\"dir\"><a href=\"%s/\">%s/</a></div>\n",
-				filenameUtf8, filenameUtf8);
-		} else {
-			wsprintfA(htmlLine,
-				"	<div class=\"file\"><a href=\"%s\">%s</a></div>\n",
-				filenameUtf8, filenameUtf8);
-		}
-		send(clientSocket, htmlLine, lstrlenA(htmlLine), 0);
-	}
-	while (FindNextFileW(hFind, &findData) != 0);
+	GetIniPath(iniPath);
 
-	FindClose(hFind);
-	send(clientSocket, HTML_END, sizeof(HTML_END) - 1, 0);
+	return (int)GetPrivateProfileIntW(L"tinyhttp", key, defaultValue, iniPath);
 }
 
-int ParseHttpRequest(const char *buffer, char *method, char *path, char *version)
+unsigned short ReadPortFromIni(void)
 {
-	const char *p = buffer;
-	char *dst;
+	unsigned short port;
+
+	port = (unsigned short)ReadIntFromIni(L"port", 8080);
 
-	while (*p == ' ' || *p == '\t') p++;
+	if (port < 1 || port > 65534)
+		port = 8080;
+	
+	return port;
+}
 
-	dst = method;
-	while (*p && *p != ' ' && *p != '\t' && (dst - method) < 15)
-		*dst++ = *p++;
+void ReadStringFromIni(const wchar_t *key, const wchar_t *defaultValue, wchar_t *buffer, int size)
+{
+	wchar_t iniPath[MAX_PATH];
 
-	*dst = '\0';
+	GetIniPath(iniPath);
 
-	while (*p == ' ' || *p == '\t') p++;
-	
-	dst = path;
-	while (*p && *p != ' ' && *p != '\t' && (dst - path) < MAX_PATH_LEN - 1)
-		*dst++ = *p++;
+	GetPrivateProfileStringW(L"tinyhttp", key, defaultValue, buffer, size, iniPath);
+}
 
-	*dst = '\0';
+int ReadLogSinkFromIni(void)
+{
+	wchar_t sink[32];
 
-	while (*p == ' ' || *p == '\t') p++;
+	ReadStringFromIni(L"log_sink", L"console", sink, 32);
 
-	dst = version;
-	while (*p && *p != ' ' && *p != '\t' && *p != '\r' && *p != '\n' && (dst - version) < 15)
-		*dst++ = *p++;
+	if (lstrcmpiW(sink, L"none") == 0)
+		return LOG_SINK_NONE;
 
-	*dst = '\0';
+	if (lstrcmpiW(sink, L"file") == 0)
+	{
+		ReadStringFromIni(L"log_file", L"tinyhttp.log", logPath, MAX_PATH);
+		return LOG_SINK_FILE;
+	}
 
-	return (method[0] && path[0] && version[0]) ? 3 : 0;
+	return LOG_SINK_CONSOLE;
 }
 
-void HandleRequest(SOCKET clientSocket, threadBuffers *buffers)
+int ReadEngineFromIni(void)
 {
-	char *p, *lineEnd;
-	char method[16], path[MAX_PATH_LEN], version[16];
-	char decodedPath[MAX_PATH_LEN];
-	char logBuffer[512];
-	WIN32_FIND_DATAW findData;
-	HANDLE hFind;
-	wchar_t widePath[MAX_PATH_LEN];
-	int bytesRead, len;
+	wchar_t engine[32];
 
-	if (!buffers || !buffers->requestBuffer)
-		return;
+	ReadStringFromIni(L"engine", L"iocp", engine, 32);
 
-	bytesRead = recv(clientSocket, buffers->requestBuffer, BUFFER_SIZE - 1, 0);
+	if (lstrcmpiW(engine, L"threads") == 0)
+		return ENGINE_THREADS;
 
-	if (bytesRead <= 0)
-		return;
+	if (lstrcmpiW(engine, L"pool") == 0)
+		return ENGINE_POOL;
 
-	buffers->requestBuffer[bytesRead] = '\0';
+	return ENGINE_IOCP;
+}
 
-	ConsoleWrite("Request: ");
-	lineEnd = xstrchr(buffers->requestBuffer, '\r');
-	if (lineEnd)
-	{
-		int requestLen = lineEnd - buffers->requestBuffer;
-		if (requestLen > 1000)
-		{
-			char tempChar = buffers->requestBuffer[1000];
-			buffers->requestBuffer[1000] = '\0';
-			ConsoleWrite(buffers->requestBuffer);
-			ConsoleWrite("... [truncated]");
-			buffers->requestBuffer[1000] = tempChar;
-		}
-		else
-		{
-			*lineEnd = '\0';
-			ConsoleWrite(buffers->requestBuffer);
-			*lineEnd = '\r';
-		}
-	}
-	else
-	{
-		int requestLen = lstrlenA(buffers->requestBuffer);
-		if (requestLen > 1000)
-		{
-			char tempChar = buffers->requestBuffer[1000];
-			buffers->requestBuffer[1000] = '\0';
-			ConsoleWrite(buffers->requestBuffer);
-			ConsoleWrite("... [truncated]");
-			buffers->requestBuffer[1000] = tempChar;
-		}
-		else
-		{
-			ConsoleWrite(buffers->requestBuffer);
-		}
-	}
+/* per connection socket options; headers and bodies leave together, so Nagle only holds back the last packet */
+static void ConfigureSocket(SOCKET s)
+{
+	BOOL opt = TRUE;
 
-	ConsoleWrite("\r\n");
+	if (noDelay)
+		setsockopt(s, IPPROTO_TCP, TCP_NODELAY, (char *)&opt, sizeof(opt));
+	if (sendBufferSize >= 0)
+		setsockopt(s, SOL_SOCKET, SO_SNDBUF, (char *)&sendBufferSize, sizeof(sendBufferSize));
+}
 
-	if (ParseHttpRequest(buffers->requestBuffer, method, path, version) != 3)
-	{
-		send(clientSocket, HTTP_404, sizeof(HTTP_404) - 1, 0);
-		return;
-	}
+/* hands accepted connections to the engine, several of these may share the listening socket */
+static DWORD WINAPI AcceptThread(LPVOID param)
+{
+	SOCKET clientSocket;
+	struct sockaddr_in clientAddr;
+	int clientLen;
+	char buffer[256];
 
-	/* :-) */
-	{
-		char safePath[256];
-		int pathLen = lstrlenA(path);
-		if (pathLen > 250)
-		{
-			lstrcpynA(safePath, path, 247);
-			lstrcatA(safePath, "...");
-		}
-		else
-		{
-			lstrcpyA(safePath, path);
-		}
-		wsprintfA(logBuffer, "Method: %s: %s\r\n", method, safePath);
-		ConsoleWrite(logBuffer);
-	}
+	if (param)
+		SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR)param);
 
-	if (lstrcmpA(method, "GET") != 0)
+	while (1)
 	{
-		const char teapotResponse[] = "HTTP/1.1 418 I'm a teapot\r\nContent-Type: text/plain\r\nServer: TinyHTTP/1.0\r\nConnection: close\r\n\r\n418 I'm a teapot\nThe requested entity body is short and stout.\n";
-		send(clientSocket, teapotResponse, sizeof(teapotResponse) - 1, 0);
-		return;
-	}
+		HANDLE threadHandle;
 
-	UrlDecode(decodedPath, path + 1);
+		clientLen = sizeof(clientAddr);
+		clientSocket = accept(serverSocket, (struct sockaddr *)&clientAddr, &clientLen);
+		if (clientSocket == INVALID_SOCKET)
+			continue;
 
-	if (lstrlenA(decodedPath) == 0)
-		lstrcpyA(decodedPath, "www");
-	else
-	{
-		char tempPath[MAX_PATH_LEN];
-		lstrcpyA(tempPath, decodedPath);
-		wsprintfA(decodedPath, "www\\%s", tempPath);
-	}
+		wsprintfA(buffer, "Connection from %s:%d\r\n", 
+				inet_ntoa(clientAddr.sin_addr), 
+				ntohs(clientAddr.sin_port));
+		LogWrite(LOG_REQUEST, buffer);
+		CountConnection(1);
+		ConfigureSocket(clientSocket);
 
-	for (p = decodedPath; *p; p++)
-		if (*p == '/') *p = '\\';
+		if (engine == ENGINE_IOCP)
+		{
+			if (!AddEventConnection(clientSocket))
+			{
+				LogWrite(LOG_ERROR, "Error: Failed to queue connection\r\n");
+				closesocket(clientSocket);
+				CountConnection(-1);
+			}
+			continue;
+		}
 
-	len = lstrlenA(decodedPath);
-	if (len > 1 && decodedPath[len - 1] == '\\')
-		decodedPath[len - 1] = '\0';
-	
-	wsprintfA(logBuffer, "Decoded path: '%s'\r\n", decodedPath);
-	ConsoleWrite(logBuffer);
+		if (engine == ENGINE_POOL)
+		{
+			QueuePoolConnection(clientSocket);
+			continue;
+		}
 
-	Utf8ToWide(decodedPath, widePath, MAX_PATH_LEN);
-	hFind = FindFirstFileW(widePath, &findData);
-	if (hFind == INVALID_HANDLE_VALUE)
-	{
-		wsprintfA(logBuffer, "File not found: %s\r\n", decodedPath);
-		ConsoleWrite(logBuffer);
-		send(clientSocket, HTTP_404, sizeof(HTTP_404) - 1, 0);
-		return;
+		threadHandle = CreateThread(NULL, 0, ClientThread, (LPVOID)clientSocket, 0, NULL);
+		if (threadHandle == NULL)
+		{
+			LogWrite(LOG_ERROR, "Error: Failed to create thread\r\n");
+			closesocket(clientSocket);
+			CountConnection(-1);
+			continue;
+		}
+		
+		CloseHandle(threadHandle);
 	}
-	FindClose(hFind);
 
-	if (findData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
-		SendDirectoryListing(clientSocket, decodedPath);
-	else
-		SendFile(clientSocket, decodedPath, buffers->fileBuffer);
+	return 0;
 }
 
-DWORD WINAPI ClientThread(LPVOID param)
+/*
+ * Starts the extra accept threads, the calling thread is the first one.
+ * With affinity set, acceptor i runs on the i-th processor the process
+ * may use, wrapping around.
+ */
+static void StartAcceptThreads(int count, int affinity, DWORD_PTR *firstMask)
 {
-	SOCKET clientSocket = (SOCKET)param;
-	struct sockaddr_in clientAddr;
-	int addr_len = sizeof(clientAddr);
-	char buffer[256];
+	DWORD_PTR processMask, systemMask, mask = 0;
+	char buffer[128];
+	int i;
 
-	threadBuffers buffers;
-	buffers.baseAllocation = (char *)HeapAlloc(GetProcessHeap(), 0, BUFFER_SIZE * 2);
+	*firstMask = 0;
+	if (affinity && (!GetProcessAffinityMask(GetCurrentProcess(), &processMask, &systemMask) || !processMask))
+		affinity = 0;
 
-	if (buffers.baseAllocation)
-	{
-		buffers.requestBuffer = buffers.baseAllocation;
-		buffers.fileBuffer = buffers.baseAllocation + BUFFER_SIZE;
-		HandleRequest(clientSocket, &buffers);
-		HeapFree(GetProcessHeap(), 0, buffers.baseAllocation);
-	}
-	else
+	for (i = 0; i < count; i++)
 	{
-		const char errorResponse[] = "HTTP/1.1 500 Internal Server Error\r\nContent-Type: text/plain\r\nServer: TinyHTTP/1.0\r\nConnection: close\r\n\r\n500 Internal Server Error\n";
-		send(clientSocket, errorResponse, sizeof(errorResponse) - 1, 0);
-	}
+		if (affinity)
+		{
+			/* the next allowed processor after the previous one */
+			do
+				mask = (mask << 1) ? mask << 1 : 1;
+			while (!(mask & processMask));
+		}
 
-	shutdown(clientSocket, SD_SEND);
+		if (i == 0)
+		{
+			*firstMask = mask;
+			continue;
+		}
 
-	if (getpeername(clientSocket, (struct sockaddr*)&clientAddr, &addr_len) == 0)
-	{
-		wsprintfA(buffer, "Connection from %s:%d closed\r\n", 
-				 inet_ntoa(clientAddr.sin_addr), 
-				 ntohs(clientAddr.sin_port));
-		ConsoleWrite(buffer);
+		{
+			HANDLE threadHandle = CreateThread(NULL, 0, AcceptThread, (LPVOID)mask, 0, NULL);
+			if (threadHandle == NULL)
+				break;
+			CloseHandle(threadHandle);
+		}
 	}
-	
-	closesocket(clientSocket);
-	return 0;
+
+	wsprintfA(buffer, "Accepting on %d threads%s\r\n", i, affinity ? ", pinned to processors" : "");
+	ConsoleWrite(buffer);
 }
 
-unsigned short ReadPortFromIni(void)
+/* whether one of the arguments is flag, given in lower case, without a CRT argv to look at */
+static int CommandLineHas(const wchar_t *flag)
 {
-	unsigned short port;
-	wchar_t *p, *lastSlash;
-	wchar_t iniPath[MAX_PATH];
-	wchar_t exePath[MAX_PATH];
-	
-	GetModuleFileNameW(NULL, exePath, MAX_PATH);
+	const wchar_t *p = GetCommandLineW(), *start;
+	int quoted, length = lstrlenW(flag), i;
 
-	lastSlash = exePath;
-	for (p = exePath; *p; p++)
+	while (*p)
 	{
-		if (*p == L'\\' || *p == L'/')
-			lastSlash = p;
-	}
+		while (*p == L' ' || *p == L'\t')
+			p++;
 
-	lstrcpyW(iniPath, exePath);
-	lstrcpyW(lastSlash + 1, L"tinyhttp.ini");
+		start = p;
+		for (quoted = 0; *p && (quoted || (*p != L' ' && *p != L'\t')); p++)
+			if (*p == L'"')
+				quoted = !quoted;
 
-	port = GetPrivateProfileIntW(L"tinyhttp", L"port", 8080, iniPath);
+		/* compared in place, the command line is shared with the rest of the process */
+		if (p - start != length)
+			continue;
+		for (i = 0; i < length; i++)
+		{
+			wchar_t c = start[i];
 
-	if (port < 1 || port > 65534)
-		port = 8080;
-	
-	return port;
+			if (c >= L'A' && c <= L'Z')
+				c += L'a' - L'A';
+			if (c != flag[i])
+				break;
+		}
+		if (i == length)
+			return 1;
+	}
+
+	return 0;
 }
 
 #if defined(_NOCRT)
@@ -435,21 +1763,29 @@ int main(int argc, char *argv[])
 {
 	BOOL opt = TRUE;
 	WSADATA wsaData;
-	SOCKET serverSocket, clientSocket;
 	struct sockaddr_in serverAddr = {0};
-	struct sockaddr_in clientAddr = {0};
-	int clientLen = sizeof(clientAddr);
-	char buffer[256];
 	unsigned short port = ReadPortFromIni();
+	int backlog = ReadIntFromIni(L"backlog", SOMAXCONN);
+	DWORD_PTR acceptMask;
 	wchar_t exePath[MAX_PATH], wwwPath[MAX_PATH];
 	wchar_t *lastSlash;
 	char wwwUtf8[MAX_PATH];
+	int bufferPool;
+
+	engine = ReadEngineFromIni();
 
 #ifndef _NOCRT
 	(void)argc;
 	(void)argv;
 #endif
 
+	/* compresses the text files under www ahead of time and exits */
+	if (CommandLineHas(L"--precompress"))
+	{
+		LoadMimeTypes("mime.txt");
+		return RunPrecompress(L"www", ReadIntFromIni(L"precompress_threads", 0)) ? 0 : 1;
+	}
+
 #if _MSC_VER > 1000
 	if (WSAStartup(MAKEWORD(1, 1), &wsaData) != 0)
 #else
@@ -488,7 +1824,8 @@ int main(int argc, char *argv[])
 		return 1;
 	}
 
-	if (listen(serverSocket, 5) == SOCKET_ERROR)
+	/* a short queue drops connections when a burst arrives faster than they are accepted */
+	if (listen(serverSocket, backlog > 0 ? backlog : SOMAXCONN) == SOCKET_ERROR)
 	{
 		ConsoleWrite("Error: Listen failed\r\n");
 		closesocket(serverSocket);
@@ -531,32 +1868,53 @@ int main(int argc, char *argv[])
 
 	ConsoleWrite("Press Ctrl+C to stop\r\n");
 
+	if (!StartLogger(ReadIntFromIni(L"log_level", LOG_REQUEST), ReadLogSinkFromIni(), logPath))
+		ConsoleWrite("Warning: Failed to start the logger, logging synchronously\r\n");
+
 	/* load mime types*/
 	LoadMimeTypes("mime.txt"); /* temporary */
 
-	while (1)
-	{
-		HANDLE threadHandle;
-		clientSocket = accept(serverSocket, (struct sockaddr *)&clientAddr, &clientLen);
-		if (clientSocket == INVALID_SOCKET)
-			continue;
+	InitStats();
+	InitMapCache((DWORDLONG)ReadIntFromIni(L"mmap_min", 0));
+	bufferPool = ReadIntFromIni(L"buffer_pool", 256);
+	InitBuffers(bufferPool);
+	if (!InitListingCache(ReadIntFromIni(L"listcache_entries", 64)))
+		ConsoleWrite("Warning: directory listing cache unavailable\r\n");
+	InitResponseCache(ReadIntFromIni(L"respcache_budget", 16 << 20), ReadIntFromIni(L"respcache_max", 65536));
+	if (!InitMetaCache(ReadIntFromIni(L"metacache_entries", 1024), ReadIntFromIni(L"metacache_ttl", 2)))
+		ConsoleWrite("Warning: metadata cache unavailable\r\n");
+	StartStatsReporter(ReadIntFromIni(L"stats_interval", 60));
+	statsEndpoint = ReadIntFromIni(L"stats_endpoint", 1);
+
+#ifdef _WINSOCK2API_
+	zeroCopyEnabled = ReadIntFromIni(L"zerocopy", 1);
+	zeroCopyMinimum = (DWORD)ReadIntFromIni(L"zerocopy_min", 65536);
+#endif
 
-		wsprintfA(buffer, "Connection from %s:%d\r\n", 
-				inet_ntoa(clientAddr.sin_addr), 
-				ntohs(clientAddr.sin_port));
-		ConsoleWrite(buffer);
+	noDelay = ReadIntFromIni(L"nodelay", 1);
+	sendBufferSize = ReadIntFromIni(L"sndbuf", -1);
+	precompressed = ReadIntFromIni(L"precompressed", 1);
+	keepAliveTimeout = ReadIntFromIni(L"keepalive_timeout", 5);
+	keepAliveMax = ReadIntFromIni(L"keepalive_max", 100);
 
-		threadHandle = CreateThread(NULL, 0, ClientThread, (LPVOID)clientSocket, 0, NULL);
-		if (threadHandle == NULL)
-		{
-			ConsoleWrite("Error: Failed to create thread\r\n");
-			closesocket(clientSocket);
-			continue;
-		}
-		
-		CloseHandle(threadHandle);
+	if (engine == ENGINE_IOCP && !StartEventLoop(keepAliveTimeout, bufferPool, ReadIntFromIni(L"iocp_batch", 64)))
+	{
+		ConsoleWrite("Warning: I/O completion ports unavailable, using one thread per connection\r\n");
+		engine = ENGINE_THREADS;
+	}
+
+	if (engine == ENGINE_POOL && !StartPool(ReadIntFromIni(L"threads", 64), ReadIntFromIni(L"queue", 1024)))
+	{
+		ConsoleWrite("Warning: Failed to start worker pool, using one thread per connection\r\n");
+		engine = ENGINE_THREADS;
 	}
 
+	/* only the event loop reads files with overlapped I/O */
+	asyncReads = engine == ENGINE_IOCP && ReadIntFromIni(L"async_reads", 1);
+
+	StartAcceptThreads(ReadIntFromIni(L"accept_threads", 1), ReadIntFromIni(L"accept_affinity", 0), &acceptMask);
+	AcceptThread((LPVOID)acceptMask);
+
 	closesocket(serverSocket);
 	WSACleanup();
 	return 0;
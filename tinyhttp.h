@@ -0,0 +1,99 @@
+/* SPDX-License-Identifier: GPL-2.0-or-later */
+
+#ifndef TINYHTTP_H
+#define TINYHTTP_H
+
+#define WIN32_LEAN_AND_MEAN
+#if defined(_MSC_VER) && _MSC_VER < 1100
+#include <winsock.h>
+#include <windows.h>
+#else
+#include <winsock2.h>
+#include <windows.h>
+#include <ws2tcpip.h>
+#include <mswsock.h>
+#endif
+
+#include "http.h"
+
+#ifndef SD_SEND
+#define SD_SEND 1
+#endif
+
+#define BUFFER_SIZE 8192
+#define MAX_PATH_LEN 1024
+
+#define MAX_RANGES 16
+#define MAX_SEGMENTS (MAX_RANGES * 2 + 2)
+
+/* TransmitFile sends at most 2^31 - 2 bytes per call */
+#define MAX_TRANSMIT 0x7FFFFFFE
+
+/* memory segments sent by a single WSASend */
+#define MAX_GATHER 8
+
+/* body blocks double in size, so a few of them hold any listing */
+#define MAX_BODY_BLOCKS 20
+
+/* part of a response: bytes in memory, or a range of the connection's file if data is NULL */
+typedef struct {
+	const char *data;
+	DWORDLONG offset;
+	DWORDLONG length;
+} segment;
+
+/* a piece of a generated body, blocks never move once allocated */
+typedef struct {
+	char *data;
+	int length;
+	int capacity;
+} bodyBlock;
+
+/* one client connection and the response currently being sent on it */
+typedef struct {
+	SOCKET socket;
+	char *requestBuffer;
+	char *fileBuffer;
+	int requestLength;
+	int requestSize;
+	int requestCount;
+	int keepAlive;
+	httpRequest request;
+	DWORDLONG requestStart;
+	DWORDLONG firstByte;
+
+	segment segments[MAX_SEGMENTS];
+	int segmentCount;
+	int segmentIndex;
+	DWORDLONG segmentSent;
+
+	bodyBlock body[MAX_BODY_BLOCKS];
+	int bodyBlocks;
+	int bodyLength;
+	HANDLE hFile;
+	DWORDLONG fileLength;
+	DWORDLONG fileSent;
+	int asyncFile;
+	struct mappedFile *mapped;
+	DWORD mapWindow;
+	const char *mapView;
+	int sendPath;
+	struct cachedResponse *cached;
+	struct arena *scratch;
+	char header[1024];
+} connection;
+
+void InitConnection(connection *conn, SOCKET clientSocket, char *buffers);
+int RequestComplete(connection *conn);
+void HandleRequest(connection *conn);
+void ResetResponse(connection *conn);
+void FinishResponse(connection *conn, int sent);
+const char *MappedBytes(connection *conn, DWORDLONG position, DWORD *length);
+void AdvanceResponse(connection *conn, DWORDLONG bytes);
+void CloseConnection(connection *conn);
+void ServeConnection(connection *conn);
+int NextRequest(connection *conn);
+
+int ReadIntFromIni(const wchar_t *key, int defaultValue);
+
+#endif
@@ -3,99 +3,242 @@
 #define WIN32_LEAN_AND_MEAN
 #include <windows.h>
 
-int Utf8ToWide(const char *utf8, wchar_t *wideStr, int maxLen)
+#include "simd.h"
+#include "unicode.h"
+
+#define REPLACEMENT_CHARACTER 0xFFFD
+
+#ifdef USE_SIMD
+/* widens the leading run of ASCII 16 bytes at a time, returns how many characters it took */
+TARGET_SSE2 static int AsciiToWideSse2(const unsigned char *src, int length, wchar_t *dst, int room)
+{
+	__m128i zero = _mm_setzero_si128();
+	int i;
+
+	for (i = 0; i + 16 <= length && i + 16 <= room; i += 16)
+	{
+		__m128i v = _mm_loadu_si128((const __m128i *)(src + i));
+
+		if (_mm_movemask_epi8(v))
+			break;
+
+		_mm_storeu_si128((__m128i *)(dst + i), _mm_unpacklo_epi8(v, zero));
+		_mm_storeu_si128((__m128i *)(dst + i + 8), _mm_unpackhi_epi8(v, zero));
+	}
+	return i;
+}
+
+/* narrows the leading run of characters below 0x80 16 at a time */
+TARGET_SSE2 static int AsciiFromWideSse2(const wchar_t *src, int length, unsigned char *dst, int room)
+{
+	__m128i high = _mm_set1_epi16((short)0xFF80), zero = _mm_setzero_si128();
+	int i;
+
+	for (i = 0; i + 16 <= length && i + 16 <= room; i += 16)
+	{
+		__m128i a = _mm_loadu_si128((const __m128i *)(src + i));
+		__m128i b = _mm_loadu_si128((const __m128i *)(src + i + 8));
+
+		if (_mm_movemask_epi8(_mm_cmpeq_epi16(_mm_and_si128(_mm_or_si128(a, b), high), zero)) != 0xFFFF)
+			break;
+
+		_mm_storeu_si128((__m128i *)(dst + i), _mm_packus_epi16(a, b));
+	}
+	return i;
+}
+#endif
+
+/*
+ * Decodes UTF-8, rejecting overlong forms, surrogates, code points past
+ * U+10FFFF and truncated or stray continuation bytes. When lossy, each bad
+ * sequence becomes U+FFFD and output that does not fit is cut short;
+ * otherwise either of those makes the conversion fail.
+ */
+static int DecodeUtf8(const char *utf8, wchar_t *wideStr, int maxLen, int lossy)
 {
 	const unsigned char *src = (const unsigned char *)utf8;
+	const unsigned char *srcEnd = src + lstrlenA(utf8);
 	wchar_t *dst = wideStr;
 	wchar_t *end = wideStr + maxLen - 1;
-	
-	while (*src && dst < end)
+
+	if (maxLen <= 0)
+		return 0;
+
+	while (src < srcEnd)
 	{
-		if (*src < 0x80)
+		unsigned int c = *src, codepoint, minimum;
+		int count, skip, i;
+
+#ifdef USE_SIMD
+		if (c < 0x80 && SimdLevel() >= SIMD_SSE2)
 		{
-			*dst++ = *src++;
+			int run = AsciiToWideSse2(src, (int)(srcEnd - src), dst, (int)(end - dst));
+
+			src += run;
+			dst += run;
+			if (src == srcEnd)
+				break;
+			c = *src;
 		}
-		else if ((*src & 0xE0) == 0xC0)
+#endif
+
+		if (dst >= end)
+			goto full;
+
+		if (c < 0x80)
 		{
-			if (src[1] && (src[1] & 0xC0) == 0x80)
-			{
-				*dst++ = ((src[0] & 0x1F) << 6) | (src[1] & 0x3F);
-				src += 2;
-			}
-			else break;
+			*dst++ = (wchar_t)c;
+			src++;
+			continue;
 		}
-		else if ((*src & 0xF0) == 0xE0)
+
+		/* the lead byte gives the length, and the smallest value that is not overlong */
+		if (c >= 0xC2 && c <= 0xDF)
 		{
-			if (src[1] && src[2] && (src[1] & 0xC0) == 0x80 && (src[2] & 0xC0) == 0x80)
-			{
-				*dst++ = ((src[0] & 0x0F) << 12) | ((src[1] & 0x3F) << 6) | (src[2] & 0x3F);
-				src += 3;
-			}
-			else break;
+			count = 1;
+			codepoint = c & 0x1F;
+			minimum = 0x80;
 		}
-		else if ((*src & 0xF8) == 0xF0)
+		else if (c >= 0xE0 && c <= 0xEF)
+		{
+			count = 2;
+			codepoint = c & 0x0F;
+			minimum = 0x800;
+		}
+		else if (c >= 0xF0 && c <= 0xF4)
+		{
+			count = 3;
+			codepoint = c & 0x07;
+			minimum = 0x10000;
+		}
+		else
 		{
-			if (src[1] && src[2] && src[3] && (src[1] & 0xC0) == 0x80 && (src[2] & 0xC0) == 0x80 && (src[3] & 0xC0) == 0x80)
+			skip = 1;
+			goto invalid;
+		}
+
+		for (i = 1; i <= count; i++)
+		{
+			if (src + i >= srcEnd || (src[i] & 0xC0) != 0x80)
 			{
-				unsigned int codepoint = ((src[0] & 0x07) << 18) | ((src[1] & 0x3F) << 12) | 
-										((src[2] & 0x3F) << 6) | (src[3] & 0x3F);
-				if (codepoint > 0xFFFF && dst + 1 < end)
-				{
-					codepoint -= 0x10000;
-					*dst++ = 0xD800 + (codepoint >> 10);
-					*dst++ = 0xDC00 + (codepoint & 0x3FF);
-				}
-				else if (codepoint <= 0xFFFF)
-					*dst++ = (wchar_t)codepoint;
-
-				src += 4;
+				skip = i;
+				goto invalid;
 			}
-			else break;
+			codepoint = (codepoint << 6) | (src[i] & 0x3F);
 		}
-		else src++;
+
+		if (codepoint < minimum || codepoint > 0x10FFFF || (codepoint >= 0xD800 && codepoint <= 0xDFFF))
+		{
+			skip = count + 1;
+			goto invalid;
+		}
+
+		if (codepoint > 0xFFFF)
+		{
+			if (dst + 1 >= end)
+				goto full;
+			codepoint -= 0x10000;
+			*dst++ = (wchar_t)(0xD800 + (codepoint >> 10));
+			*dst++ = (wchar_t)(0xDC00 + (codepoint & 0x3FF));
+		}
+		else
+			*dst++ = (wchar_t)codepoint;
+
+		src += count + 1;
+		continue;
+
+	invalid:
+		if (!lossy)
+		{
+			*wideStr = L'\0';
+			return 0;
+		}
+		*dst++ = REPLACEMENT_CHARACTER;
+		src += skip;
 	}
 
 	*dst = L'\0';
 	return (int)(dst - wideStr + 1);
+
+full:
+	if (!lossy)
+	{
+		*wideStr = L'\0';
+		return 0;
+	}
+	*dst = L'\0';
+	return (int)(dst - wideStr + 1);
+}
+
+int Utf8ToWide(const char *utf8, wchar_t *wideStr, int maxLen)
+{
+	return DecodeUtf8(utf8, wideStr, maxLen, 0);
+}
+
+int Utf8ToWideLossy(const char *utf8, wchar_t *wideStr, int maxLen)
+{
+	return DecodeUtf8(utf8, wideStr, maxLen, 1);
 }
 
 int WideToUtf8(const wchar_t *wideStr, char *utf8, int maxLen)
 {
 	const wchar_t *src = wideStr;
+	const wchar_t *srcEnd = src + lstrlenW(wideStr);
 	unsigned char *dst = (unsigned char *)utf8;
 	unsigned char *end = (unsigned char *)utf8 + maxLen - 1;
 
-	while (*src && dst < end)
+	if (maxLen <= 0)
+		return 0;
+
+	while (src < srcEnd)
 	{
-		unsigned int codepoint = *src;
+		unsigned int codepoint;
+
+#ifdef USE_SIMD
+		if (*src < 0x80 && SimdLevel() >= SIMD_SSE2)
+		{
+			int run = AsciiFromWideSse2(src, (int)(srcEnd - src), dst, (int)(end - dst));
+
+			src += run;
+			dst += run;
+			if (src == srcEnd)
+				break;
+		}
+#endif
+
+		codepoint = *src;
 
-		if (codepoint >= 0xD800 && codepoint <= 0xDBFF && src[1] >= 0xDC00 && src[1] <= 0xDFFF)
+		if (codepoint >= 0xD800 && codepoint <= 0xDBFF && src + 1 < srcEnd && src[1] >= 0xDC00 && src[1] <= 0xDFFF)
 		{
 			codepoint = 0x10000 + ((codepoint & 0x3FF) << 10) + (src[1] & 0x3FF);
 			src += 2;
 		}
+		else if (codepoint >= 0xD800 && codepoint <= 0xDFFF)
+			/* an unpaired surrogate has no UTF-8 form */
+			goto fail;
 		else src++;
 		
 		if (codepoint < 0x80)
 		{
+			if (dst >= end) goto fail;
 			*dst++ = (unsigned char)codepoint;
 		}
 		else if (codepoint < 0x800)
 		{
-			if (dst + 1 >= end) break;
+			if (dst + 1 >= end) goto fail;
 			*dst++ = 0xC0 | (codepoint >> 6);
 			*dst++ = 0x80 | (codepoint & 0x3F);
 		}
 		else if (codepoint < 0x10000)
 		{
-			if (dst + 2 >= end) break;
+			if (dst + 2 >= end) goto fail;
 			*dst++ = 0xE0 | (codepoint >> 12);
 			*dst++ = 0x80 | ((codepoint >> 6) & 0x3F);
 			*dst++ = 0x80 | (codepoint & 0x3F);
 		}
 		else
 		{
-			if (dst + 3 >= end) break;
+			if (dst + 3 >= end) goto fail;
 			*dst++ = 0xF0 | (codepoint >> 18);
 			*dst++ = 0x80 | ((codepoint >> 12) & 0x3F);
 			*dst++ = 0x80 | ((codepoint >> 6) & 0x3F);
@@ -105,4 +248,8 @@ int WideToUtf8(const wchar_t *wideStr, char *utf8, int maxLen)
 	
 	*dst = '\0';
 	return (int)((char *)dst - utf8 + 1);
-}
\ No newline at end of file
+
+fail:
+	*utf8 = '\0';
+	return 0;
+}
@@ -3,7 +3,14 @@
 #ifndef UNICODE_H
 #define UNICODE_H
 
+/*
+ * Both return the number of characters written including the terminator,
+ * or 0 with an empty string if the input is not valid or does not fit.
+ */
 int Utf8ToWide(const char *utf8, wchar_t *wideStr, int maxLen);
 int WideToUtf8(const wchar_t *wideStr, char *utf8, int maxLen);
 
+/* for text that is only displayed: bad sequences become U+FFFD and long input is cut short */
+int Utf8ToWideLossy(const char *utf8, wchar_t *wideStr, int maxLen);
+
 #endif
@@ -4,17 +4,236 @@
 #include <windows.h>
 
 #include "unicode.h"
+#include "simd.h"
 
 #ifndef __GNUC__
 #define __attribute__(x)
 #endif
 
+/*
+ * SSE2 and AVX2 versions of the scanning functions, picked at run time from
+ * what CPUID reports. Compilers without the intrinsics, and other CPUs, get
+ * the byte loops only.
+ */
+#ifdef USE_SIMD
+static int simdLevel = -1;
+
+static int FirstBit(unsigned int mask)
+{
+#ifdef _MSC_VER
+	unsigned long index;
+	_BitScanForward(&index, mask);
+	return (int)index;
+#else
+	return __builtin_ctz(mask);
+#endif
+}
+
+static int LastBit(unsigned int mask)
+{
+#ifdef _MSC_VER
+	unsigned long index;
+	_BitScanReverse(&index, mask);
+	return (int)index;
+#else
+	return 31 - __builtin_clz(mask);
+#endif
+}
+
+static int DetectSimd(void)
+{
+	unsigned int a, b, c, d, xcr0;
+	int level = SIMD_NONE;
+#ifdef _MSC_VER
+	int info[4];
+
+	__cpuid(info, 0);
+	a = (unsigned int)info[0];
+	if (a < 1)
+		return SIMD_NONE;
+	__cpuid(info, 1);
+	c = (unsigned int)info[2];
+	d = (unsigned int)info[3];
+#else
+	if (!__get_cpuid(1, &a, &b, &c, &d))
+		return SIMD_NONE;
+#endif
+
+	if (d & (1 << 26))
+		level = SIMD_SSE2;
+
+	/* AVX2 also needs the OS to save the YMM registers, OSXSAVE and AVX then XCR0 */
+	if (level && (c & (1 << 27)) && (c & (1 << 28)))
+	{
+#ifdef _MSC_VER
+		xcr0 = (unsigned int)_xgetbv(0);
+		__cpuid(info, 0);
+		if (info[0] >= 7)
+		{
+			__cpuidex(info, 7, 0);
+			b = (unsigned int)info[1];
+		}
+		else
+			b = 0;
+#else
+		__asm__ __volatile__ ("xgetbv" : "=a" (xcr0), "=d" (d) : "c" (0));
+		if (__get_cpuid_max(0, NULL) >= 7)
+			__cpuid_count(7, 0, a, b, c, d);
+		else
+			b = 0;
+#endif
+		if ((xcr0 & 6) == 6 && (b & (1 << 5)))
+			level = SIMD_AVX2;
+	}
+
+	return level;
+}
+
+/* a race on the first calls only ever stores the same value */
+int SimdLevel(void)
+{
+	if (simdLevel < 0)
+		simdLevel = DetectSimd();
+	return simdLevel;
+}
+
+/*
+ * The string scans read whole aligned blocks, which can start before s and
+ * end past the terminator but never cross into another page.
+ */
+TARGET_SSE2 static char *StrChrSse2(const char *s, int c)
+{
+	const char *p = (const char *)((size_t)s & ~(size_t)15);
+	unsigned int mask = (0xFFFFu << (s - p)) & 0xFFFF;
+	__m128i zero = _mm_setzero_si128(), needle = _mm_set1_epi8((char)c);
+
+	for (;;)
+	{
+		__m128i v = _mm_load_si128((const __m128i *)p);
+		unsigned int nul = (unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(v, zero)) & mask;
+		unsigned int hit = (unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(v, needle)) & mask;
+
+		if (hit | nul)
+		{
+			if (hit && (!nul || FirstBit(hit) <= FirstBit(nul)))
+				return (char *)p + FirstBit(hit);
+			return NULL;
+		}
+
+		p += 16;
+		mask = 0xFFFF;
+	}
+}
+
+TARGET_SSE2 static char *StrRChrSse2(const char *s, int c)
+{
+	const char *p = (const char *)((size_t)s & ~(size_t)15), *last = NULL;
+	unsigned int mask = (0xFFFFu << (s - p)) & 0xFFFF;
+	__m128i zero = _mm_setzero_si128(), needle = _mm_set1_epi8((char)c);
+
+	for (;;)
+	{
+		__m128i v = _mm_load_si128((const __m128i *)p);
+		unsigned int nul = (unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(v, zero)) & mask;
+		unsigned int hit = (unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(v, needle)) & mask;
+
+		if (nul)
+		{
+			/* only the bytes before the terminator count */
+			hit &= (nul & (0u - nul)) - 1;
+			return hit ? (char *)p + LastBit(hit) : (char *)last;
+		}
+		if (hit)
+			last = p + LastBit(hit);
+
+		p += 16;
+		mask = 0xFFFF;
+	}
+}
+
+TARGET_SSE2 static size_t MemChrSse2(const unsigned char *p, int c, size_t len)
+{
+	__m128i needle = _mm_set1_epi8((char)c);
+	size_t i;
+
+	for (i = 0; i + 16 <= len; i += 16)
+	{
+		__m128i v = _mm_loadu_si128((const __m128i *)(p + i));
+		unsigned int hit = (unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(v, needle));
+		if (hit)
+			return i + FirstBit(hit);
+	}
+	return i;
+}
+
+TARGET_AVX2 static size_t MemChrAvx2(const unsigned char *p, int c, size_t len)
+{
+	__m256i needle = _mm256_set1_epi8((char)c);
+	size_t i;
+
+	for (i = 0; i + 32 <= len; i += 32)
+	{
+		__m256i v = _mm256_loadu_si256((const __m256i *)(p + i));
+		unsigned int hit = (unsigned int)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, needle));
+		if (hit)
+			return i + FirstBit(hit);
+	}
+	return i;
+}
+
+/* control characters and space are the bytes that are at most 0x20 when compared unsigned */
+TARGET_SSE2 static size_t ScanDelimSse2(const unsigned char *p, size_t len)
+{
+	__m128i space = _mm_set1_epi8(0x20), del = _mm_set1_epi8(0x7F);
+	__m128i percent = _mm_set1_epi8('%'), plus = _mm_set1_epi8('+');
+	size_t i;
+
+	for (i = 0; i + 16 <= len; i += 16)
+	{
+		__m128i v = _mm_loadu_si128((const __m128i *)(p + i));
+		__m128i hits = _mm_or_si128(_mm_cmpeq_epi8(_mm_min_epu8(v, space), v),
+									_mm_or_si128(_mm_cmpeq_epi8(v, del),
+												 _mm_or_si128(_mm_cmpeq_epi8(v, percent), _mm_cmpeq_epi8(v, plus))));
+		unsigned int hit = (unsigned int)_mm_movemask_epi8(hits);
+		if (hit)
+			return i + FirstBit(hit);
+	}
+	return i;
+}
+
+TARGET_AVX2 static size_t ScanDelimAvx2(const unsigned char *p, size_t len)
+{
+	__m256i space = _mm256_set1_epi8(0x20), del = _mm256_set1_epi8(0x7F);
+	__m256i percent = _mm256_set1_epi8('%'), plus = _mm256_set1_epi8('+');
+	size_t i;
+
+	for (i = 0; i + 32 <= len; i += 32)
+	{
+		__m256i v = _mm256_loadu_si256((const __m256i *)(p + i));
+		__m256i hits = _mm256_or_si256(_mm256_cmpeq_epi8(_mm256_min_epu8(v, space), v),
+									   _mm256_or_si256(_mm256_cmpeq_epi8(v, del),
+													   _mm256_or_si256(_mm256_cmpeq_epi8(v, percent), _mm256_cmpeq_epi8(v, plus))));
+		unsigned int hit = (unsigned int)_mm256_movemask_epi8(hits);
+		if (hit)
+			return i + FirstBit(hit);
+	}
+	return i;
+}
+#endif
+
 char *xstrrchr(const char *s, int c)
 {
-	int len = lstrlenA(s);
+	int len;
+
+#ifdef USE_SIMD
+	if (SimdLevel() >= SIMD_SSE2)
+		return StrRChrSse2(s, c);
+#endif
+
+	len = lstrlenA(s);
 	c = (unsigned char)c;
 	while(len--)
-		if(s[len] == c)
+		if((unsigned char)s[len] == c)
 			return (char *)s + len;
 	return 0;
 }
@@ -30,10 +249,15 @@ wchar_t *xstrrchrW(const wchar_t *s, wchar_t c)
 
 char *xstrchr(const char *str, int c)
 {
+#ifdef USE_SIMD
+	if (SimdLevel() >= SIMD_SSE2)
+		return StrChrSse2(str, c);
+#endif
+
 	c = (unsigned char)c;
 	while (*str)
 	{
-		if (*str == c)
+		if ((unsigned char)*str == c)
 			return (char *)str;
 
 		str++;
@@ -45,17 +269,143 @@ void *xmemchr(const void *str, int c, size_t len)
 {
 	const unsigned char *p = str;
 	c = (unsigned char)c;
+
+#ifdef USE_SIMD
+	if (SimdLevel() >= SIMD_SSE2)
+	{
+		size_t skip = SimdLevel() >= SIMD_AVX2 ? MemChrAvx2(p, c, len) : MemChrSse2(p, c, len);
+		p += skip;
+		len -= skip;
+	}
+#endif
+
 	for(; len && *p != c; p++, len--);
 	return len ? (void *)p : NULL;
 }
 
+/* offset of the first control character, space, DEL, '%' or '+' in s, or len if there is none */
+size_t xscandelim(const char *s, size_t len)
+{
+	const unsigned char *p = (const unsigned char *)s;
+	size_t i = 0;
+
+#ifdef USE_SIMD
+	if (SimdLevel() >= SIMD_AVX2)
+		i = ScanDelimAvx2(p, len);
+	else if (SimdLevel() >= SIMD_SSE2)
+		i = ScanDelimSse2(p, len);
+#endif
+
+	for (; i < len; i++)
+	{
+		if (p[i] <= ' ' || p[i] == 0x7F || p[i] == '%' || p[i] == '+')
+			break;
+	}
+	return i;
+}
+
+/* ASCII only, which is all HTTP header names need */
+int xstrnicmp(const char *a, const char *b, size_t len)
+{
+	for (; len; a++, b++, len--)
+	{
+		int ca = (unsigned char)*a, cb = (unsigned char)*b;
+		if (ca >= 'A' && ca <= 'Z') ca += 'a' - 'A';
+		if (cb >= 'A' && cb <= 'Z') cb += 'a' - 'A';
+		if (ca != cb || !ca)
+			return ca - cb;
+	}
+	return 0;
+}
+
+/* case insensitive FNV-1a, for hashing paths */
+DWORD xstrihash(const char *s)
+{
+	DWORD hash = 2166136261UL;
+
+	for (; *s; s++)
+	{
+		int c = (unsigned char)*s;
+		if (c >= 'A' && c <= 'Z')
+			c += 'a' - 'A';
+		hash = (hash ^ c) * 16777619UL;
+	}
+	return hash;
+}
+
+/*
+ * 64 by 32 bit division in 32 bit operations only: shifts and multiplies
+ * of 64 bit values by a variable call _aullshr and friends on MSVC x86,
+ * which a CRT-less build does not have. Shifts by a constant 32 are fine.
+ */
+DWORDLONG xdiv64(DWORDLONG n, DWORD d)
+{
+	DWORD high = (DWORD)(n >> 32), low = (DWORD)n, remainder, quotient = 0, carry, bit;
+
+	if (!d)
+		return 0;
+	if (!high)
+		return low / d;
+
+	/* the high word divides directly, its remainder is below d */
+	remainder = high % d;
+	high /= d;
+
+	/* then the low word bit by bit, the remainder stays in 32 bits plus a carry */
+	for (bit = 0x80000000UL; bit; bit >>= 1)
+	{
+		carry = remainder & 0x80000000UL;
+		remainder = (remainder << 1) | ((low & bit) ? 1 : 0);
+		if (carry || remainder >= d)
+		{
+			remainder -= d;
+			quotient |= bit;
+		}
+	}
+
+	return ((DWORDLONG)high << 32) | quotient;
+}
+
+/* value * 10 + digit for parsing decimals, each word multiplied on its own like xdiv64 */
+DWORDLONG xmul10add(DWORDLONG value, int digit)
+{
+	DWORD high = (DWORD)(value >> 32);
+	DWORDLONG low = UInt32x32To64((DWORD)value, 10) + (DWORD)digit;
+
+	high = high * 10 + (DWORD)(low >> 32);
+	return ((DWORDLONG)high << 32) | (DWORD)low;
+}
+
+/* buffer needs room for 21 characters, returns the length */
+int xu64toa(DWORDLONG value, char *buffer)
+{
+	char digits[20];
+	int count = 0, i;
+
+	do
+	{
+		DWORDLONG quotient = xdiv64(value, 10);
+
+		/* the remainder fits in the low words, no 64 bit multiply needed */
+		digits[count++] = (char)('0' + (int)((DWORD)value - (DWORD)quotient * 10));
+		value = quotient;
+	}
+	while (value);
+
+	for (i = 0; i < count; i++)
+		buffer[i] = digits[count - 1 - i];
+	buffer[count] = '\0';
+
+	return count;
+}
+
 void ConsoleWrite(const char *message)
 {
 	HANDLE hStdout = GetStdHandle(STD_OUTPUT_HANDLE);
 	if (hStdout != INVALID_HANDLE_VALUE)
 	{
 		wchar_t wideBuffer[4096];
-		int wLen = Utf8ToWide(message, wideBuffer, sizeof(wideBuffer) / sizeof(wchar_t));
+		int wLen = Utf8ToWideLossy(message, wideBuffer, sizeof(wideBuffer) / sizeof(wchar_t));
 		if (wLen > 0)
 		{
 			__attribute__((unused)) DWORD written;
@@ -7,6 +7,13 @@ char *xstrrchr(const char *s, int c);
 wchar_t *xstrrchrW(const wchar_t *s, wchar_t c);
 char *xstrchr(const char *str, int c);
 void *xmemchr(const void *str, int c, size_t len);
+size_t xscandelim(const char *s, size_t len);
+int xstrnicmp(const char *a, const char *b, size_t len);
+DWORD xstrihash(const char *s);
+
+DWORDLONG xdiv64(DWORDLONG n, DWORD d);
+DWORDLONG xmul10add(DWORDLONG value, int digit);
+int xu64toa(DWORDLONG value, char *buffer);
 
 void ConsoleWrite(const char *message);
 